@@ -0,0 +1,107 @@
+#include "cam_arena.h"
+
+void cam_arena_init(cam_arena_t *arena, uint8_t *buf, size_t size, cam_arena_block_t *blocks, size_t max_blocks)
+{
+    arena->buf = buf;
+    arena->size = size;
+    arena->head = 0;
+    arena->tail = 0;
+    arena->blocks = blocks;
+    arena->max_blocks = max_blocks;
+    arena->first = 0;
+    arena->count = 0;
+}
+
+int cam_arena_reserve(cam_arena_t *arena, size_t len)
+{
+    if (len == 0 || len > arena->size || arena->count == arena->max_blocks) {
+        return -1;
+    }
+
+    size_t offset;
+    if (arena->count == 0) {
+        arena->head = 0;
+        arena->tail = 0;
+        offset = 0;
+    } else if (arena->head > arena->tail) {
+        //free space is after the head and before the tail, blocks never straddle the end
+        if (arena->size - arena->head >= len) {
+            offset = arena->head;
+        } else if (arena->tail >= len) {
+            offset = 0;
+        } else {
+            return -1;
+        }
+    } else {
+        //wrapped, the only free space is between head and tail. head == tail means full
+        if (arena->tail - arena->head >= len) {
+            offset = arena->head;
+        } else {
+            return -1;
+        }
+    }
+
+    size_t block = (arena->first + arena->count) % arena->max_blocks;
+    arena->blocks[block].offset = offset;
+    arena->blocks[block].len = len;
+    arena->blocks[block].refs = 1;
+    arena->count++;
+    arena->head = offset + len;
+    return block;
+}
+
+uint8_t *cam_arena_data(const cam_arena_t *arena, int block)
+{
+    return arena->buf + arena->blocks[block].offset;
+}
+
+void cam_arena_commit(cam_arena_t *arena, int block, size_t len)
+{
+    cam_arena_block_t *b = &arena->blocks[block];
+    //an empty block would make head == tail ambiguous
+    if (len == 0) {
+        len = 1;
+    }
+    if (len > b->len) {
+        len = b->len;
+    }
+    b->len = len;
+    if (block == (arena->first + arena->count - 1) % arena->max_blocks) {
+        arena->head = b->offset + len;
+    }
+}
+
+void cam_arena_retain(cam_arena_t *arena, int block)
+{
+    arena->blocks[block].refs++;
+}
+
+bool cam_arena_release(cam_arena_t *arena, int block)
+{
+    if (--arena->blocks[block].refs) {
+        return false;
+    }
+
+    while (arena->count && arena->blocks[arena->first].refs == 0) {
+        arena->first = (arena->first + 1) % arena->max_blocks;
+        arena->count--;
+    }
+    if (arena->count) {
+        arena->tail = arena->blocks[arena->first].offset;
+    } else {
+        arena->head = 0;
+        arena->tail = 0;
+    }
+    return true;
+}
+
+size_t cam_arena_used(const cam_arena_t *arena)
+{
+    if (arena->count == 0) {
+        return 0;
+    }
+    if (arena->head > arena->tail) {
+        return arena->head - arena->tail;
+    }
+    return arena->size - arena->tail + arena->head;
+}
@@ -17,6 +17,7 @@
 #include "esp_heap_caps.h"
 #include "ll_cam.h"
 #include "cam_hal.h"
+#include "jpeg_markers.h"
 
 #if (ESP_IDF_VERSION_MAJOR == 3) && (ESP_IDF_VERSION_MINOR == 3)
 #include "rom/ets_sys.h"
@@ -38,43 +39,97 @@
 #define CAM_TASK_STACK             (2*1024)
 #endif
 
+#ifdef CONFIG_CAMERA_TAKE_MAX_RETRIES
+#define CAM_TAKE_MAX_RETRIES       CONFIG_CAMERA_TAKE_MAX_RETRIES
+#else
+#define CAM_TAKE_MAX_RETRIES       3
+#endif
+
+//JPEG frame buffers are sized in whole DMA nodes on every target
+#define CAM_JPEG_FB_SIZE_ALIGN     4096
+#define CAM_FB_SIZE_MIN_SAMPLES    64
+
 static const char *TAG = "cam_hal";
 static cam_obj_t *cam_obj = NULL;
+//cam_task reserves and commits pool frames, any task may release them
+static portMUX_TYPE cam_arena_lock = portMUX_INITIALIZER_UNLOCKED;
+//every counter has a single writer, either cam_task or the task taking frames
+static camera_stats_t cam_stats;
+//written by the task taking frames only
+static camera_fb_size_histogram_t cam_fb_sizes;
+//frames started by cam_task, and the last one handed out by cam_take
+static uint32_t cam_frame_sequence;
+static uint32_t cam_taken_sequence;
 
-static const uint32_t JPEG_SOI_MARKER = 0xFFD8FF;  // written in little-endian for esp32
 static const uint16_t JPEG_EOI_MARKER = 0xD9FF;  // written in little-endian for esp32
 
 static int cam_verify_jpeg_soi(const uint8_t *inbuf, uint32_t length)
 {
-    uint32_t sig = *((uint32_t *)inbuf) & 0xFFFFFF;
-    if(sig != JPEG_SOI_MARKER) {
-        for (uint32_t i = 0; i < length; i++) {
-            sig = *((uint32_t *)(&inbuf[i])) & 0xFFFFFF;
-            if (sig == JPEG_SOI_MARKER) {
-                ESP_LOGW(TAG, "SOI: %d", (int) i);
-                return i;
-            }
-        }
+    int offset = jpeg_find_soi(inbuf, length);
+    if (offset != 0) {
+        cam_stats.no_soi++;
+    }
+    if (offset > 0) {
+        ESP_LOGW(TAG, "SOI: %d", offset);
+    } else if (offset < 0) {
         ESP_LOGW(TAG, "NO-SOI");
-        return -1;
     }
-    return 0;
+    return offset;
 }
 
-static int cam_verify_jpeg_eoi(const uint8_t *inbuf, uint32_t length)
+static cam_frame_t *cam_get_frame(camera_fb_t *dma_buffer)
 {
-    int offset = -1;
-    uint8_t *dptr = (uint8_t *)inbuf + length - 2;
-    while (dptr > inbuf) {
-        uint16_t sig = *((uint16_t *)dptr);
-        if (JPEG_EOI_MARKER == sig) {
-            offset = dptr - inbuf;
-            //ESP_LOGW(TAG, "EOI: %d", length - (offset + 2));
-            return offset;
+    for (int x = 0; x < cam_obj->frame_cnt; x++) {
+        if (&cam_obj->frames[x].fb == dma_buffer) {
+            return &cam_obj->frames[x];
         }
-        dptr--;
     }
-    return -1;
+    return NULL;
+}
+
+//Look for EOI in the chunk just copied, so the frame can be handed over as soon as it is complete.
+//This reads every byte of every JPEG frame in cam_task, several times the work of the backwards scan
+//of only the padding that cam_take did before (bench_jpeg_markers, "eoi tracked")
+static void cam_track_jpeg_eoi(cam_frame_t *frame, size_t chunk_start)
+{
+    //start one byte early to catch a marker split between two chunks
+    size_t from = chunk_start ? chunk_start - 1 : 0;
+    int offset = jpeg_find_last_eoi(&frame->fb.buf[from], frame->fb.len - from);
+    if (offset >= 0) {
+        frame->eoi_offset = from + offset;
+    }
+}
+
+//Give the frame back to cam_task. Pool frames keep their memory until the last reference is dropped
+static void cam_release_frame(cam_frame_t *frame)
+{
+    if (cam_obj->fb_pool && frame->arena_block >= 0) {
+        portENTER_CRITICAL(&cam_arena_lock);
+        bool last = cam_arena_release(&cam_obj->arena, frame->arena_block);
+        portEXIT_CRITICAL(&cam_arena_lock);
+        if (!last) {
+            return;
+        }
+        frame->arena_block = -1;
+        frame->fb.buf = NULL;
+    }
+    frame->en = 1;
+}
+
+//Pool frames get room for a whole frame while they are written, the unused part is returned when they are sent
+static bool cam_reserve_frame(cam_frame_t *frame)
+{
+    if (!cam_obj->fb_pool || frame->arena_block >= 0) {
+        return true;
+    }
+    portENTER_CRITICAL(&cam_arena_lock);
+    frame->arena_block = cam_arena_reserve(&cam_obj->arena, cam_obj->fb_size);
+    portEXIT_CRITICAL(&cam_arena_lock);
+    if (frame->arena_block < 0) {
+        return false;
+    }
+    frame->fb.buf = cam_arena_data(&cam_obj->arena, frame->arena_block);
+    return true;
 }
 
 static bool cam_get_next_frame(int * frame_pos)
@@ -94,13 +149,14 @@ static bool cam_get_next_frame(int * frame_pos)
 
 static bool cam_start_frame(int * frame_pos)
 {
-    if (cam_get_next_frame(frame_pos)) {
+    if (cam_get_next_frame(frame_pos) && cam_reserve_frame(&cam_obj->frames[*frame_pos])) {
         if(ll_cam_start(cam_obj, *frame_pos)){
             // Vsync the frame manually
             ll_cam_do_vsync(cam_obj);
             uint64_t us = (uint64_t)esp_timer_get_time();
             cam_obj->frames[*frame_pos].fb.timestamp.tv_sec = us / 1000000UL;
             cam_obj->frames[*frame_pos].fb.timestamp.tv_usec = us % 1000000UL;
+            cam_obj->frames[*frame_pos].fb.meta.sequence = ++cam_frame_sequence;
             return true;
         }
     }
@@ -116,6 +172,37 @@ void IRAM_ATTR ll_cam_send_event(cam_obj_t *cam, cam_event_t cam_event, BaseType
     }
 }
 
+static void cam_send_frame(int frame_pos)
+{
+    camera_fb_t * frame_buffer_event = &cam_obj->frames[frame_pos].fb;
+    uint64_t vsync_us = (uint64_t)frame_buffer_event->timestamp.tv_sec * 1000000UL + frame_buffer_event->timestamp.tv_usec;
+    frame_buffer_event->meta.dma_us = (uint64_t)esp_timer_get_time() - vsync_us;
+    if (cam_obj->fb_pool) {
+        portENTER_CRITICAL(&cam_arena_lock);
+        cam_arena_commit(&cam_obj->arena, cam_obj->frames[frame_pos].arena_block, frame_buffer_event->len);
+        portEXIT_CRITICAL(&cam_arena_lock);
+    }
+    if(xQueueSend(cam_obj->frame_buffer_queue, (void *)&frame_buffer_event, 0) != pdTRUE) {
+        //pop frame buffer from the queue
+        camera_fb_t * fb2 = NULL;
+        if(xQueueReceive(cam_obj->frame_buffer_queue, &fb2, 0) == pdTRUE) {
+            //push the new frame to the end of the queue
+            if (xQueueSend(cam_obj->frame_buffer_queue, (void *)&frame_buffer_event, 0) != pdTRUE) {
+                cam_release_frame(&cam_obj->frames[frame_pos]);
+                cam_stats.fbq_send++;
+                ESP_LOGE(TAG, "FBQ-SND");
+            }
+            //free the popped buffer
+            cam_give(fb2);
+        } else {
+            //queue is full and we could not pop a frame from it
+            cam_release_frame(&cam_obj->frames[frame_pos]);
+            cam_stats.fbq_receive++;
+            ESP_LOGE(TAG, "FBQ-RCV");
+        }
+    }
+}
+
 //Copy fram from DMA dma_buffer to fram dma_buffer
 static void cam_task(void *arg)
 {
@@ -136,6 +223,7 @@ static void cam_task(void *arg)
                     //DBG_PIN_SET(1);
                     if(cam_start_frame(&frame_pos)){
                         cam_obj->frames[frame_pos].fb.len = 0;
+                        cam_obj->frames[frame_pos].eoi_offset = -1;
                         cam_obj->state = CAM_STATE_READ_BUF;
                     }
                     cnt = 0;
@@ -151,19 +239,32 @@ static void cam_task(void *arg)
                     if(!cam_obj->psram_mode){
                         if (cam_obj->fb_size < (frame_buffer_event->len + pixels_per_dma)) {
                             ESP_LOGW(TAG, "FB-OVF");
+                            cam_stats.fb_overflow++;
                             ll_cam_stop(cam_obj);
                             DBG_PIN_SET(0);
                             continue;
                         }
+                        size_t chunk_start = frame_buffer_event->len;
                         frame_buffer_event->len += ll_cam_memcpy(cam_obj,
                             &frame_buffer_event->buf[frame_buffer_event->len],
                             &cam_obj->dma_buffer[(cnt % cam_obj->dma_half_buffer_cnt) * cam_obj->dma_half_buffer_size],
                             cam_obj->dma_half_buffer_size);
+                        if (cam_obj->jpeg_mode) {
+                            cam_track_jpeg_eoi(&cam_obj->frames[frame_pos], chunk_start);
+                        }
                     }
                     //Check for JPEG SOI in the first buffer. stop if not found
                     if (cam_obj->jpeg_mode && cnt == 0 && cam_verify_jpeg_soi(frame_buffer_event->buf, frame_buffer_event->len) != 0) {
                         ll_cam_stop(cam_obj);
                         cam_obj->state = CAM_STATE_IDLE;
+                    } else if (cam_obj->jpeg_mode && cam_obj->frames[frame_pos].eoi_offset >= 0) {
+                        //The JPEG is complete, the rest until VSYNC is padding. Hand the frame over now
+                        //instead of copying the padding, the next VSYNC starts the following frame from idle
+                        ll_cam_stop(cam_obj);
+                        frame_buffer_event->len = cam_obj->frames[frame_pos].eoi_offset + sizeof(JPEG_EOI_MARKER);
+                        cam_obj->frames[frame_pos].en = 0;
+                        cam_send_frame(frame_pos);
+                        cam_obj->state = CAM_STATE_IDLE;
                     }
                     cnt++;
 
@@ -176,12 +277,15 @@ static void cam_task(void *arg)
                             if (!cam_obj->psram_mode) {
                                 if (cam_obj->fb_size < (frame_buffer_event->len + pixels_per_dma)) {
                                     ESP_LOGW(TAG, "FB-OVF");
+                                    cam_stats.fb_overflow++;
                                     cnt--;
                                 } else {
+                                    size_t chunk_start = frame_buffer_event->len;
                                     frame_buffer_event->len += ll_cam_memcpy(cam_obj,
                                         &frame_buffer_event->buf[frame_buffer_event->len],
                                         &cam_obj->dma_buffer[(cnt % cam_obj->dma_half_buffer_cnt) * cam_obj->dma_half_buffer_size],
                                         cam_obj->dma_half_buffer_size);
+                                    cam_track_jpeg_eoi(&cam_obj->frames[frame_pos], chunk_start);
                                 }
                             }
                             cnt++;
@@ -202,22 +306,8 @@ static void cam_task(void *arg)
                             }
                         }
                         //send frame
-                        if(!cam_obj->frames[frame_pos].en && xQueueSend(cam_obj->frame_buffer_queue, (void *)&frame_buffer_event, 0) != pdTRUE) {
-                            //pop frame buffer from the queue
-                            camera_fb_t * fb2 = NULL;
-                            if(xQueueReceive(cam_obj->frame_buffer_queue, &fb2, 0) == pdTRUE) {
-                                //push the new frame to the end of the queue
-                                if (xQueueSend(cam_obj->frame_buffer_queue, (void *)&frame_buffer_event, 0) != pdTRUE) {
-                                    cam_obj->frames[frame_pos].en = 1;
-                                    ESP_LOGE(TAG, "FBQ-SND");
-                                }
-                                //free the popped buffer
-                                cam_give(fb2);
-                            } else {
-                                //queue is full and we could not pop a frame from it
-                                cam_obj->frames[frame_pos].en = 1;
-                                ESP_LOGE(TAG, "FBQ-RCV");
-                            }
+                        if(!cam_obj->frames[frame_pos].en) {
+                            cam_send_frame(frame_pos);
                         }
                     }
 
@@ -225,6 +315,7 @@ static void cam_task(void *arg)
                         cam_obj->state = CAM_STATE_IDLE;
                     } else {
                         cam_obj->frames[frame_pos].fb.len = 0;
+                        cam_obj->frames[frame_pos].eoi_offset = -1;
                     }
                     cnt = 0;
                 }
@@ -291,10 +382,26 @@ static esp_err_t cam_dma_config(const camera_config_t *config)
     } else {
         _caps |= MALLOC_CAP_SPIRAM;
     }
+    if (cam_obj->fb_pool) {
+        size_t pool_size = fb_size * config->fb_count;
+        ESP_LOGI(TAG, "Allocating %d Byte frame pool for %d frames in %s", pool_size, cam_obj->frame_cnt, _caps & MALLOC_CAP_SPIRAM ? "PSRAM" : "OnBoard RAM");
+        //a frame released out of order keeps its record until the older ones are released too
+        size_t max_blocks = cam_obj->frame_cnt * 2;
+        cam_arena_init(&cam_obj->arena, (uint8_t *)heap_caps_malloc(pool_size, _caps), pool_size,
+                       (cam_arena_block_t *)heap_caps_malloc(max_blocks * sizeof(cam_arena_block_t), MALLOC_CAP_DEFAULT), max_blocks);
+        CAM_CHECK(cam_obj->arena.buf != NULL, "frame pool malloc failed", ESP_FAIL);
+        CAM_CHECK(cam_obj->arena.blocks != NULL, "frame pool blocks malloc failed", ESP_FAIL);
+    }
     for (int x = 0; x < cam_obj->frame_cnt; x++) {
         cam_obj->frames[x].dma = NULL;
         cam_obj->frames[x].fb_offset = 0;
         cam_obj->frames[x].en = 0;
+        cam_obj->frames[x].arena_block = -1;
+        if (cam_obj->fb_pool) {
+            //memory is taken from the pool when cam_task starts writing the frame
+            cam_obj->frames[x].en = 1;
+            continue;
+        }
         ESP_LOGI(TAG, "Allocating %d Byte frame buffer in %s", alloc_size, _caps & MALLOC_CAP_SPIRAM ? "PSRAM" : "OnBoard RAM");
 #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 3, 0)
         // In IDF v4.2 and earlier, memory returned by heap_caps_aligned_alloc must be freed using heap_caps_aligned_free.
@@ -337,6 +444,10 @@ esp_err_t cam_init(const camera_config_t *config)
     esp_err_t ret = ESP_OK;
     cam_obj = (cam_obj_t *)heap_caps_calloc(1, sizeof(cam_obj_t), MALLOC_CAP_DMA);
     CAM_CHECK(NULL != cam_obj, "lcd_cam object malloc error", ESP_ERR_NO_MEM);
+    memset(&cam_stats, 0, sizeof(cam_stats));
+    memset(&cam_fb_sizes, 0, sizeof(cam_fb_sizes));
+    cam_frame_sequence = 0;
+    cam_taken_sequence = 0;
 
     cam_obj->swap_data = 0;
     cam_obj->vsync_pin = config->pin_vsync;
@@ -374,12 +485,20 @@ esp_err_t cam_config(const camera_config_t *config, framesize_t frame_size, uint
 #else
     cam_obj->psram_mode = (config->xclk_freq_hz == 16000000);
 #endif
-    cam_obj->frame_cnt = config->fb_count;
+    cam_obj->fb_pool = config->fb_pool && cam_obj->jpeg_mode && !cam_obj->psram_mode;
+    if (config->fb_pool && !cam_obj->fb_pool) {
+        ESP_LOGW(TAG, "Frame pool needs JPEG without EDMA, using separate frame buffers");
+    }
+    cam_obj->frame_cnt = config->fb_count * (cam_obj->fb_pool ? CAMERA_FB_POOL_FRAMES_PER_FB : 1);
     cam_obj->width = resolution[frame_size].width;
     cam_obj->height = resolution[frame_size].height;
 
     if(cam_obj->jpeg_mode){
         cam_obj->recv_size = cam_obj->width * cam_obj->height / 5;
+        //a size learned from earlier frames replaces the worst case estimate
+        if (config->jpeg_fb_size) {
+            cam_obj->recv_size = (config->jpeg_fb_size + CAM_JPEG_FB_SIZE_ALIGN - 1) / CAM_JPEG_FB_SIZE_ALIGN * CAM_JPEG_FB_SIZE_ALIGN;
+        }
         cam_obj->fb_size = cam_obj->recv_size;
     } else {
         cam_obj->recv_size = cam_obj->width * cam_obj->height * cam_obj->in_bytes_per_pixel;
@@ -441,9 +560,15 @@ esp_err_t cam_deinit(void)
     if (cam_obj->dma_buffer) {
         free(cam_obj->dma_buffer);
     }
+    if (cam_obj->fb_pool) {
+        free(cam_obj->arena.buf);
+        free(cam_obj->arena.blocks);
+    }
     if (cam_obj->frames) {
         for (int x = 0; x < cam_obj->frame_cnt; x++) {
-            free(cam_obj->frames[x].fb.buf - cam_obj->frames[x].fb_offset);
+            if (!cam_obj->fb_pool) {
+                free(cam_obj->frames[x].fb.buf - cam_obj->frames[x].fb_offset);
+            }
             if (cam_obj->frames[x].dma) {
                 free(cam_obj->frames[x].dma);
             }
@@ -469,41 +594,110 @@ void cam_start(void)
     ll_cam_vsync_intr_enable(cam_obj, true);
 }
 
+static void cam_record_fb_size(size_t len)
+{
+    size_t bucket = len / CAMERA_FB_SIZE_BUCKET_BYTES;
+    cam_fb_sizes.buckets[bucket < CAMERA_FB_SIZE_BUCKETS ? bucket : CAMERA_FB_SIZE_BUCKETS - 1]++;
+    cam_fb_sizes.count++;
+    if (len > cam_fb_sizes.max_len) {
+        cam_fb_sizes.max_len = len;
+    }
+}
+
 camera_fb_t *cam_take(TickType_t timeout)
 {
-    camera_fb_t *dma_buffer = NULL;
     TickType_t start = xTaskGetTickCount();
-    xQueueReceive(cam_obj->frame_buffer_queue, (void *)&dma_buffer, timeout);
-    if (dma_buffer) {
+    for (int attempt = 0; attempt <= CAM_TAKE_MAX_RETRIES; attempt++) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (attempt > 0 && elapsed >= timeout) {
+            ESP_LOGW(TAG, "Failed to get the frame on time!");
+            return NULL;
+        }
+
+        camera_fb_t *dma_buffer = NULL;
+        xQueueReceive(cam_obj->frame_buffer_queue, (void *)&dma_buffer, timeout - elapsed);
+        if (!dma_buffer) {
+            ESP_LOGW(TAG, "Failed to get the frame on time!");
+            return NULL;
+        }
+
         if(cam_obj->jpeg_mode){
             // find the end marker for JPEG. Data after that can be discarded
-            int offset_e = cam_verify_jpeg_eoi(dma_buffer->buf, dma_buffer->len);
-            if (offset_e >= 0) {
-                // adjust buffer length
-                dma_buffer->len = offset_e + sizeof(JPEG_EOI_MARKER);
-                return dma_buffer;
-            } else {
+            // without PSRAM mode cam_task already found it while copying the chunks
+            int offset_e = cam_obj->psram_mode ? jpeg_find_last_eoi(dma_buffer->buf, dma_buffer->len)
+                                               : cam_get_frame(dma_buffer)->eoi_offset;
+            if (offset_e < 0) {
                 ESP_LOGW(TAG, "NO-EOI");
+                cam_stats.no_eoi++;
                 cam_give(dma_buffer);
-                return cam_take(timeout - (xTaskGetTickCount() - start));//recurse!!!!
+                continue;
             }
+            // adjust buffer length
+            dma_buffer->len = offset_e + sizeof(JPEG_EOI_MARKER);
+            cam_record_fb_size(dma_buffer->len);
         } else if(cam_obj->psram_mode && cam_obj->in_bytes_per_pixel != cam_obj->fb_bytes_per_pixel){
             //currently this is used only for YUV to GRAYSCALE
             dma_buffer->len = ll_cam_memcpy(cam_obj, dma_buffer->buf, dma_buffer->buf, dma_buffer->len);
         }
+        //frames dropped by cam_task or skipped above left a gap in the sequence
+        uint32_t sequence = dma_buffer->meta.sequence;
+        dma_buffer->meta.dropped = sequence > cam_taken_sequence ? sequence - cam_taken_sequence - 1 : 0;
+        cam_taken_sequence = sequence;
         return dma_buffer;
-    } else {
-        ESP_LOGW(TAG, "Failed to get the frame on time!");
     }
+
+    ESP_LOGW(TAG, "No valid frame after %d attempts", CAM_TAKE_MAX_RETRIES + 1);
+    cam_stats.retries_exhausted++;
     return NULL;
 }
 
 void cam_give(camera_fb_t *dma_buffer)
 {
-    for (int x = 0; x < cam_obj->frame_cnt; x++) {
-        if (&cam_obj->frames[x].fb == dma_buffer) {
-            cam_obj->frames[x].en = 1;
-            break;
-        }
+    cam_frame_t *frame = cam_get_frame(dma_buffer);
+    if (frame) {
+        cam_release_frame(frame);
+    }
+}
+
+esp_err_t cam_retain(camera_fb_t *dma_buffer)
+{
+    if (!cam_obj->fb_pool) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    cam_frame_t *frame = cam_get_frame(dma_buffer);
+    if (!frame || frame->arena_block < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    portENTER_CRITICAL(&cam_arena_lock);
+    cam_arena_retain(&cam_obj->arena, frame->arena_block);
+    portEXIT_CRITICAL(&cam_arena_lock);
+    return ESP_OK;
+}
+
+void cam_get_stats(camera_stats_t *stats)
+{
+    *stats = cam_stats;
+}
+
+void cam_get_fb_size_histogram(camera_fb_size_histogram_t *histogram)
+{
+    *histogram = cam_fb_sizes;
+    histogram->fb_size = cam_obj->fb_size;
+}
+
+size_t cam_suggest_jpeg_fb_size(void)
+{
+    if (!cam_obj->jpeg_mode || cam_fb_sizes.count < CAM_FB_SIZE_MIN_SAMPLES) {
+        return 0;
     }
+
+    //frames that overflowed were dropped before their size was known, so grow past the current size
+    size_t size = cam_fb_sizes.max_len + cam_fb_sizes.max_len / 4;
+    if (cam_stats.fb_overflow && size < cam_obj->fb_size + cam_obj->fb_size / 2) {
+        size = cam_obj->fb_size + cam_obj->fb_size / 2;
+    }
+
+    //cam_task needs room for one more DMA chunk than the frame itself
+    size += cam_obj->dma_half_buffer_size;
+    return (size + CAM_JPEG_FB_SIZE_ALIGN - 1) / CAM_JPEG_FB_SIZE_ALIGN * CAM_JPEG_FB_SIZE_ALIGN;
 }
@@ -369,10 +369,53 @@ camera_fb_t *esp_camera_fb_get()
         fb->width = resolution[s_state->sensor.status.framesize].width;
         fb->height = resolution[s_state->sensor.status.framesize].height;
         fb->format = s_state->sensor.pixformat;
+
+        //read over SCCB here rather than in cam_task, which must keep up with the DMA
+        int aec_value, agc_gain;
+        sensor_t *s = &s_state->sensor;
+        if (s->get_aec_agc && s->get_aec_agc(s, &aec_value, &agc_gain) == 0) {
+            fb->meta.aec_value = aec_value;
+            fb->meta.agc_gain = agc_gain;
+        } else {
+            fb->meta.aec_value = -1;
+            fb->meta.agc_gain = -1;
+        }
     }
     return fb;
 }
 
+esp_err_t esp_camera_get_stats(camera_stats_t *stats)
+{
+    if (s_state == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (stats == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    cam_get_stats(stats);
+    return ESP_OK;
+}
+
+esp_err_t esp_camera_get_fb_size_histogram(camera_fb_size_histogram_t *histogram)
+{
+    if (s_state == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (histogram == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    cam_get_fb_size_histogram(histogram);
+    return ESP_OK;
+}
+
+size_t esp_camera_suggest_jpeg_fb_size(void)
+{
+    if (s_state == NULL) {
+        return 0;
+    }
+    return cam_suggest_jpeg_fb_size();
+}
+
 void esp_camera_fb_return(camera_fb_t *fb)
 {
     if (s_state == NULL) {
@@ -381,6 +424,14 @@ void esp_camera_fb_return(camera_fb_t *fb)
     cam_give(fb);
 }
 
+esp_err_t esp_camera_fb_retain(camera_fb_t *fb)
+{
+    if (s_state == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return cam_retain(fb);
+}
+
 sensor_t *esp_camera_sensor_get()
 {
     if (s_state == NULL) {
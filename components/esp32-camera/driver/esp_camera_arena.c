@@ -0,0 +1,71 @@
+#include <stdlib.h>
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "esp_camera_arena.h"
+#include "cam_arena.h"
+
+struct esp_camera_arena {
+    cam_arena_t arena;
+};
+
+esp_camera_arena_t *esp_camera_arena_create(size_t size, size_t max_blocks, uint32_t caps)
+{
+    esp_camera_arena_t *ring = calloc(1, sizeof(esp_camera_arena_t));
+    uint8_t *buf = heap_caps_malloc(size, caps);
+    cam_arena_block_t *blocks = heap_caps_malloc(max_blocks * sizeof(cam_arena_block_t), caps);
+    if (!ring || !buf || !blocks) {
+        free(ring);
+        free(buf);
+        free(blocks);
+        return NULL;
+    }
+    cam_arena_init(&ring->arena, buf, size, blocks, max_blocks);
+    return ring;
+}
+
+void esp_camera_arena_delete(esp_camera_arena_t *ring)
+{
+    if (!ring) {
+        return;
+    }
+    free(ring->arena.buf);
+    free(ring->arena.blocks);
+    free(ring);
+}
+
+int esp_camera_arena_push(esp_camera_arena_t *ring, const uint8_t *data, size_t len)
+{
+    int block = cam_arena_reserve(&ring->arena, len);
+    if (block >= 0) {
+        memcpy(cam_arena_data(&ring->arena, block), data, len);
+    }
+    return block;
+}
+
+void esp_camera_arena_pop(esp_camera_arena_t *ring)
+{
+    if (ring->arena.count) {
+        //blocks here only ever hold the one reference taken when they were pushed
+        cam_arena_release(&ring->arena, ring->arena.first);
+    }
+}
+
+size_t esp_camera_arena_count(const esp_camera_arena_t *ring)
+{
+    return ring->arena.count;
+}
+
+int esp_camera_arena_block(const esp_camera_arena_t *ring, size_t index)
+{
+    return (ring->arena.first + index) % ring->arena.max_blocks;
+}
+
+const uint8_t *esp_camera_arena_data(const esp_camera_arena_t *ring, int block)
+{
+    return cam_arena_data(&ring->arena, block);
+}
+
+size_t esp_camera_arena_len(const esp_camera_arena_t *ring, int block)
+{
+    return ring->arena.blocks[block].len;
+}
@@ -149,8 +149,26 @@ typedef struct {
 #endif
 
     int sccb_i2c_port;              /*!< If pin_sccb_sda is -1, use the already configured I2C bus by number */
+    size_t jpeg_fb_size;            /*!< JPEG frame buffer size in bytes, e.g. from esp_camera_suggest_jpeg_fb_size. 0 sizes it for the worst case, width * height / 5 */
+    bool fb_pool;                   /*!< JPEG only: pack frames back to back into one buffer of fb_count frame buffers, holding up to CAMERA_FB_POOL_FRAMES_PER_FB times as many frames. Not with EDMA */
 } camera_config_t;
 
+/**
+ * @brief Frames the JPEG frame pool can hold per frame buffer worth of memory
+ */
+#define CAMERA_FB_POOL_FRAMES_PER_FB 3
+
+/**
+ * @brief Per-frame information from the driver and the sensor
+ */
+typedef struct {
+    uint32_t sequence;          /*!< Frames started by the driver since initialization, from 1. Gaps are frames that were not delivered */
+    uint32_t dropped;           /*!< Frames started but not delivered since the previous frame from esp_camera_fb_get */
+    int32_t aec_value;          /*!< Sensor exposure when the frame was taken, in set_aec_value units. -1 if the sensor can't report it */
+    int32_t agc_gain;           /*!< Sensor gain when the frame was taken, in set_agc_gain units. -1 if the sensor can't report it */
+    uint32_t dma_us;            /*!< Microseconds from the frame's VSYNC until its last DMA buffer was copied */
+} camera_fb_meta_t;
+
 /**
  * @brief Data structure of camera frame buffer
  */
@@ -161,8 +179,34 @@ typedef struct {
     size_t height;              /*!< Height of the buffer in pixels */
     pixformat_t format;         /*!< Format of the pixel data */
     struct timeval timestamp;   /*!< Timestamp since boot of the first DMA buffer of the frame */
+    camera_fb_meta_t meta;      /*!< Filled in by esp_camera_fb_get */
 } camera_fb_t;
 
+/**
+ * @brief Counters of frames the driver dropped since esp_camera_init
+ */
+typedef struct {
+    uint32_t no_soi;            /*!< JPEG frames not starting with a SOI marker */
+    uint32_t no_eoi;            /*!< JPEG frames without an EOI marker */
+    uint32_t fb_overflow;       /*!< Frames larger than the frame buffer */
+    uint32_t fbq_receive;       /*!< Frames lost because the full frame queue could not be drained */
+    uint32_t fbq_send;          /*!< Frames lost because the frame queue refused them after draining */
+    uint32_t retries_exhausted; /*!< esp_camera_fb_get calls that gave up after too many corrupt frames in a row */
+} camera_stats_t;
+
+#define CAMERA_FB_SIZE_BUCKETS 32
+#define CAMERA_FB_SIZE_BUCKET_BYTES 4096
+
+/**
+ * @brief Distribution of JPEG frame sizes since esp_camera_init
+ */
+typedef struct {
+    uint32_t count;                             /*!< Frames recorded */
+    uint32_t max_len;                           /*!< Largest frame recorded */
+    uint32_t fb_size;                           /*!< Size of the frame buffers the frames were captured into */
+    uint32_t buckets[CAMERA_FB_SIZE_BUCKETS];   /*!< Frames of i * CAMERA_FB_SIZE_BUCKET_BYTES up to the next bucket, the last one also counts everything larger */
+} camera_fb_size_histogram_t;
+
 #define ESP_ERR_CAMERA_BASE 0x20000
 #define ESP_ERR_CAMERA_NOT_DETECTED             (ESP_ERR_CAMERA_BASE + 1)
 #define ESP_ERR_CAMERA_FAILED_TO_SET_FRAME_SIZE (ESP_ERR_CAMERA_BASE + 2)
@@ -199,10 +243,48 @@ esp_err_t esp_camera_deinit();
 /**
  * @brief Obtain pointer to a frame buffer.
  *
- * @return pointer to the frame buffer
+ * JPEG frames without an end marker are dropped and the next frame is waited for,
+ * up to CONFIG_CAMERA_TAKE_MAX_RETRIES frames within the same timeout.
+ *
+ * @return pointer to the frame buffer, NULL on timeout or after too many corrupt frames
  */
 camera_fb_t* esp_camera_fb_get();
 
+/**
+ * @brief Get the counters of dropped and corrupt frames
+ *
+ * @param stats  Filled with the current counters
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if stats is NULL
+ *      - ESP_ERR_INVALID_STATE if the driver hasn't been initialized yet
+ */
+esp_err_t esp_camera_get_stats(camera_stats_t *stats);
+
+/**
+ * @brief Get the distribution of JPEG frame sizes
+ *
+ * @param histogram  Filled with the sizes of the frames returned by esp_camera_fb_get so far
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if histogram is NULL
+ *      - ESP_ERR_INVALID_STATE if the driver hasn't been initialized yet
+ */
+esp_err_t esp_camera_get_fb_size_histogram(camera_fb_size_histogram_t *histogram);
+
+/**
+ * @brief Suggest a JPEG frame buffer size for camera_config_t.jpeg_fb_size
+ *
+ * Based on the frames seen since esp_camera_init: the largest one plus a quarter of headroom,
+ * or half again the current size if frames overflowed the buffers. Frame buffers are only
+ * allocated in esp_camera_init, so the suggestion takes effect on the next initialization.
+ *
+ * @return Suggested size in bytes, 0 if not in JPEG mode or too few frames were seen yet
+ */
+size_t esp_camera_suggest_jpeg_fb_size(void);
+
 /**
  * @brief Return the frame buffer to be reused again.
  *
@@ -210,6 +292,22 @@ camera_fb_t* esp_camera_fb_get();
  */
 void esp_camera_fb_return(camera_fb_t * fb);
 
+/**
+ * @brief Keep a frame buffer from the JPEG frame pool past its first esp_camera_fb_return
+ *
+ * Every call needs a matching esp_camera_fb_return before the memory is reused. Frames held
+ * for long pin the pool, since space is reclaimed from the oldest frame on.
+ *
+ * @param fb    Pointer to the frame buffer
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_SUPPORTED if the frame pool is not in use
+ *      - ESP_ERR_INVALID_ARG if fb is not a frame from the pool
+ *      - ESP_ERR_INVALID_STATE if the driver hasn't been initialized yet
+ */
+esp_err_t esp_camera_fb_retain(camera_fb_t * fb);
+
 /**
  * @brief Get a pointer to the image sensor control structure
  *
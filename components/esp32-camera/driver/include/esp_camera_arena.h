@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief First in, first out ring of variable length blocks packed back to back in one buffer
+ *
+ * The same ring as the driver's frame pool, for applications that keep copies of recent frames.
+ * Blocks are appended at the head and dropped from the tail; a block that does not fit before the
+ * end of the buffer starts over at its beginning. Block ids are below the max_blocks given at
+ * creation, so they can index arrays of per block data. No locking is done.
+ */
+typedef struct esp_camera_arena esp_camera_arena_t;
+
+/**
+ * @brief Allocate a ring of size bytes holding up to max_blocks blocks, from memory with the given heap_caps
+ *
+ * @return The ring, or NULL if it can't be allocated
+ */
+esp_camera_arena_t *esp_camera_arena_create(size_t size, size_t max_blocks, uint32_t caps);
+
+/**
+ * @brief Free a ring and all blocks in it
+ */
+void esp_camera_arena_delete(esp_camera_arena_t *arena);
+
+/**
+ * @brief Append a copy of len bytes as the newest block
+ *
+ * @return Block id, or -1 if there is no room until older blocks are dropped
+ */
+int esp_camera_arena_push(esp_camera_arena_t *arena, const uint8_t *data, size_t len);
+
+/**
+ * @brief Drop the oldest block
+ */
+void esp_camera_arena_pop(esp_camera_arena_t *arena);
+
+/**
+ * @brief Number of blocks in the ring
+ */
+size_t esp_camera_arena_count(const esp_camera_arena_t *arena);
+
+/**
+ * @brief Id of the block at position index, 0 being the oldest
+ */
+int esp_camera_arena_block(const esp_camera_arena_t *arena, size_t index);
+
+/**
+ * @brief Start of a block's data
+ */
+const uint8_t *esp_camera_arena_data(const esp_camera_arena_t *arena, int block);
+
+/**
+ * @brief Length of a block
+ */
+size_t esp_camera_arena_len(const esp_camera_arena_t *arena, int block);
+
+#ifdef __cplusplus
+}
+#endif
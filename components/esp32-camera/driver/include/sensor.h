@@ -250,6 +250,8 @@ typedef struct _sensor {
     int  (*set_res_raw)         (sensor_t *sensor, int startX, int startY, int endX, int endY, int offsetX, int offsetY, int totalX, int totalY, int outputX, int outputY, bool scale, bool binning);
     int  (*set_pll)             (sensor_t *sensor, int bypass, int mul, int sys, int root, int pre, int seld5, int pclken, int pclk);
     int  (*set_xclk)            (sensor_t *sensor, int timer, int xclk);
+    int  (*get_aec_agc)         (sensor_t *sensor, int *aec_value, int *agc_gain); // Current exposure and gain in set_aec_value and set_agc_gain units, NULL if not supported
+    int  (*set_mode_presets)    (sensor_t *sensor, const framesize_t *framesizes, int count); // Precompute the registers of these frame sizes for the current pixformat, so set_framesize can switch between them by writing only what differs. NULL if not supported
 } sensor_t;
 
 camera_sensor_info_t *esp_camera_sensor_get_info(sensor_id_t *id);
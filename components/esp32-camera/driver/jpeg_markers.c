@@ -0,0 +1,92 @@
+#include <stdbool.h>
+#include <string.h>
+#include "jpeg_markers.h"
+
+// Every JPEG marker starts with 0xFF and entropy coded data stuffs each 0xFF with a 0x00,
+// so most words hold no 0xFF at all and are skipped with a single test
+#define WORD_SIZE sizeof(uint32_t)
+#define ONES  0x01010101u
+#define HIGHS 0x80808080u
+
+static inline bool has_ff_byte(uint32_t word)
+{
+    // Zero-byte test on the inverted word: a byte of ~word is zero exactly where word has 0xFF
+    return ((~word - ONES) & word & HIGHS) != 0;
+}
+
+static inline uint32_t load_aligned(const uint8_t *at)
+{
+    uint32_t word;
+    memcpy(&word, at, sizeof(word));
+    return word;
+}
+
+static inline bool is_soi(const uint8_t *buf, size_t length, size_t i)
+{
+    return i + 2 < length && buf[i] == 0xFF && buf[i + 1] == 0xD8 && buf[i + 2] == 0xFF;
+}
+
+static inline bool is_eoi(const uint8_t *buf, size_t length, size_t i)
+{
+    return i + 1 < length && buf[i] == 0xFF && buf[i + 1] == 0xD9;
+}
+
+int jpeg_find_soi(const uint8_t *buf, size_t length)
+{
+    size_t i = 0;
+    while (i < length && ((uintptr_t)&buf[i] & (WORD_SIZE - 1))) {
+        if (is_soi(buf, length, i)) {
+            return i;
+        }
+        i++;
+    }
+
+    for (; i + WORD_SIZE <= length; i += WORD_SIZE) {
+        if (!has_ff_byte(load_aligned(&buf[i]))) {
+            continue;
+        }
+        for (size_t k = i; k < i + WORD_SIZE; k++) {
+            if (is_soi(buf, length, k)) {
+                return k;
+            }
+        }
+    }
+
+    for (; i < length; i++) {
+        if (is_soi(buf, length, i)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int jpeg_find_last_eoi(const uint8_t *buf, size_t length)
+{
+    size_t i = length;
+    while (i > 0 && ((uintptr_t)&buf[i] & (WORD_SIZE - 1))) {
+        i--;
+        if (is_eoi(buf, length, i)) {
+            return i;
+        }
+    }
+
+    // i is aligned here; a marker straddling two words is found through its 0xFF byte
+    for (; i >= WORD_SIZE; i -= WORD_SIZE) {
+        if (!has_ff_byte(load_aligned(&buf[i - WORD_SIZE]))) {
+            continue;
+        }
+        for (size_t k = i; k > i - WORD_SIZE; k--) {
+            if (is_eoi(buf, length, k - 1)) {
+                return k - 1;
+            }
+        }
+    }
+
+    while (i > 0) {
+        i--;
+        if (is_eoi(buf, length, i)) {
+            return i;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief One allocation in the arena, in the order it was reserved
+ */
+typedef struct {
+    size_t offset;
+    size_t len;
+    uint16_t refs;
+} cam_arena_block_t;
+
+/**
+ * @brief Ring of variable length blocks packed back to back in one buffer
+ *
+ * A block is reserved for the largest size it may need and then committed with its real length,
+ * so only the bytes actually written stay occupied. Blocks may be released in any order; their
+ * space is reclaimed once every older block has been released as well. A block that does not fit
+ * before the end of the buffer starts over at its beginning, leaving the tail unused until then.
+ *
+ * The arena does no locking of its own. Outside the driver it is used through esp_camera_arena.h.
+ */
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t head;                //end of the newest block
+    size_t tail;                //start of the oldest block
+    cam_arena_block_t *blocks;  //allocation records, oldest at first
+    size_t max_blocks;
+    size_t first;
+    size_t count;
+} cam_arena_t;
+
+/**
+ * @brief Set up an empty arena over buf, tracking up to max_blocks allocations
+ */
+void cam_arena_init(cam_arena_t *arena, uint8_t *buf, size_t size, cam_arena_block_t *blocks, size_t max_blocks);
+
+/**
+ * @brief Reserve len contiguous bytes, holding one reference
+ *
+ * @return Block id, or -1 if there is no room or no free allocation record
+ */
+int cam_arena_reserve(cam_arena_t *arena, size_t len);
+
+/**
+ * @brief Start of a block's data
+ */
+uint8_t *cam_arena_data(const cam_arena_t *arena, int block);
+
+/**
+ * @brief Shrink the newest block to the len bytes actually used
+ */
+void cam_arena_commit(cam_arena_t *arena, int block, size_t len);
+
+/**
+ * @brief Take another reference to a block
+ */
+void cam_arena_retain(cam_arena_t *arena, int block);
+
+/**
+ * @brief Drop a reference to a block
+ *
+ * @return true if that was the last reference
+ */
+bool cam_arena_release(cam_arena_t *arena, int block);
+
+/**
+ * @brief Bytes held by blocks, including any tail skipped over by a wrap
+ */
+size_t cam_arena_used(const cam_arena_t *arena);
+
+#ifdef __cplusplus
+}
+#endif
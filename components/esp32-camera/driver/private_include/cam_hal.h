@@ -55,6 +55,14 @@ camera_fb_t *cam_take(TickType_t timeout);
 
 void cam_give(camera_fb_t *dma_buffer);
 
+esp_err_t cam_retain(camera_fb_t *dma_buffer);
+
+void cam_get_stats(camera_stats_t *stats);
+
+void cam_get_fb_size_histogram(camera_fb_size_histogram_t *histogram);
+
+size_t cam_suggest_jpeg_fb_size(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Find the first JPEG SOI marker (FF D8 FF)
+ *
+ * Scans a word at a time with aligned loads and never reads past the end of the buffer.
+ *
+ * @return Offset of the marker, or -1 if there is none
+ */
+int jpeg_find_soi(const uint8_t *buf, size_t length);
+
+/**
+ * @brief Find the last JPEG EOI marker (FF D9)
+ *
+ * Scans backwards a word at a time with aligned loads and never reads past the end of the buffer.
+ *
+ * @return Offset of the marker's first byte, or -1 if there is none
+ */
+int jpeg_find_last_eoi(const uint8_t *buf, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
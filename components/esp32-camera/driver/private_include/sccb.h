@@ -9,6 +9,12 @@
 #ifndef __SCCB_H__
 #define __SCCB_H__
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+//registers a sensor driver collects before handing them to SCCB_WriteBatch
+#define SCCB_BATCH_MAX 32
+
 int SCCB_Init(int pin_sda, int pin_scl);
 int SCCB_Use_Port(int sccb_i2c_port);
 int SCCB_Deinit(void);
@@ -17,4 +23,7 @@ uint8_t SCCB_Read(uint8_t slv_addr, uint8_t reg);
 uint8_t SCCB_Write(uint8_t slv_addr, uint8_t reg, uint8_t data);
 uint8_t SCCB_Read16(uint8_t slv_addr, uint16_t reg);
 uint8_t SCCB_Write16(uint8_t slv_addr, uint16_t reg, uint8_t data);
+uint8_t SCCB_WriteBatch(uint8_t slv_addr, const uint16_t (*regs)[2], size_t count);
+//auto_increment only for sensors documented to take several data bytes per transfer
+uint8_t SCCB_WriteBatch16(uint8_t slv_addr, const uint16_t (*regs)[2], size_t count, bool auto_increment);
 #endif // __SCCB_H__
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Inclusive range of registers the sensor changes on its own, which are never cached
+ */
+typedef struct {
+    uint16_t first;
+    uint16_t last;
+} sccb_shadow_range_t;
+
+typedef struct {
+    uint16_t reg;
+    uint8_t value;
+    uint8_t used;
+} sccb_shadow_entry_t;
+
+/**
+ * @brief Last known value of the sensor registers the driver has written or read
+ *
+ * Lets read-modify-write updates skip the read and lets writes of an unchanged value skip the
+ * bus entirely. Registers are looked up in a small open addressed table; once it is three
+ * quarters full, registers not in it yet simply pass through uncached.
+ *
+ * The shadow does no locking of its own, callers already serialize SCCB access per sensor.
+ */
+typedef struct {
+    sccb_shadow_entry_t *entries;               //NULL while disabled
+    size_t size;                                //power of two
+    size_t count;
+    const sccb_shadow_range_t *volatile_ranges;
+    size_t num_volatile;
+} sccb_shadow_t;
+
+/**
+ * @brief Allocate an empty shadow of size entries, or clear it if it is already allocated
+ *
+ * @return false if the table could not be allocated, in which case every access goes to the bus
+ */
+bool sccb_shadow_init(sccb_shadow_t *shadow, size_t size, const sccb_shadow_range_t *volatile_ranges, size_t num_volatile);
+
+/**
+ * @brief Free the table, every later access goes to the bus
+ */
+void sccb_shadow_deinit(sccb_shadow_t *shadow);
+
+/**
+ * @brief Forget every register, e.g. after a sensor reset or a failed write
+ */
+void sccb_shadow_clear(sccb_shadow_t *shadow);
+
+/**
+ * @brief Look up the last known value of reg
+ *
+ * @return false if the value is unknown and has to be read from the sensor
+ */
+bool sccb_shadow_get(const sccb_shadow_t *shadow, uint16_t reg, uint8_t *value);
+
+/**
+ * @brief Record a value just written to or read from reg
+ */
+void sccb_shadow_set(sccb_shadow_t *shadow, uint16_t reg, uint8_t value);
+
+#ifdef __cplusplus
+}
+#endif
@@ -204,3 +204,46 @@ uint8_t SCCB_Write16(uint8_t slv_addr, uint16_t reg, uint8_t data)
     }
     return ret == ESP_OK ? 0 : -1;
 }
+
+//every transfer ends in a STOP, since OmniVision SCCB does not take repeated starts, and goes out
+//as a command list of its own. Only an auto-incrementing sensor (the OV5640 with 16 bit addresses)
+//gets the following registers as more data bytes of the same transfer
+static uint8_t write_batch(uint8_t slv_addr, const uint16_t (*regs)[2], size_t count, bool reg16, bool auto_increment)
+{
+    for (size_t i = 0; i < count; ) {
+        size_t run = 1;
+        while (auto_increment && i + run < count && regs[i + run][0] == regs[i][0] + run) {
+            run++;
+        }
+
+        i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+        i2c_master_start(cmd);
+        i2c_master_write_byte(cmd, ( slv_addr << 1 ) | WRITE_BIT, ACK_CHECK_EN);
+        if (reg16) {
+            i2c_master_write_byte(cmd, regs[i][0] >> 8, ACK_CHECK_EN);
+        }
+        i2c_master_write_byte(cmd, regs[i][0] & 0xFF, ACK_CHECK_EN);
+        for (size_t j = 0; j < run; j++) {
+            i2c_master_write_byte(cmd, regs[i + j][1], ACK_CHECK_EN);
+        }
+        i2c_master_stop(cmd);
+        esp_err_t ret = i2c_master_cmd_begin(sccb_i2c_port, cmd, 1000 / portTICK_RATE_MS);
+        i2c_cmd_link_delete(cmd);
+        if(ret != ESP_OK) {
+            ESP_LOGE(TAG, "SCCB_WriteBatch Failed addr:0x%02x, %u regs from 0x%04x, ret:%d", slv_addr, (unsigned)run, regs[i][0], ret);
+            return -1;
+        }
+        i += run;
+    }
+    return 0;
+}
+
+uint8_t SCCB_WriteBatch(uint8_t slv_addr, const uint16_t (*regs)[2], size_t count)
+{
+    return write_batch(slv_addr, regs, count, false, false);
+}
+
+uint8_t SCCB_WriteBatch16(uint8_t slv_addr, const uint16_t (*regs)[2], size_t count, bool auto_increment)
+{
+    return write_batch(slv_addr, regs, count, true, auto_increment);
+}
@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <string.h>
+#include "sccb_shadow.h"
+
+static bool is_volatile(const sccb_shadow_t *shadow, uint16_t reg)
+{
+    for (size_t i = 0; i < shadow->num_volatile; i++) {
+        if (reg >= shadow->volatile_ranges[i].first && reg <= shadow->volatile_ranges[i].last) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//registers come in dense runs, multiplicative hashing spreads them over the whole table
+static size_t slot_of(const sccb_shadow_t *shadow, uint16_t reg)
+{
+    return ((uint32_t)reg * 40503u >> 4) & (shadow->size - 1);
+}
+
+static sccb_shadow_entry_t *find(const sccb_shadow_t *shadow, uint16_t reg)
+{
+    size_t slot = slot_of(shadow, reg);
+    while (shadow->entries[slot].used) {
+        if (shadow->entries[slot].reg == reg) {
+            return &shadow->entries[slot];
+        }
+        slot = (slot + 1) & (shadow->size - 1);
+    }
+    return &shadow->entries[slot];
+}
+
+bool sccb_shadow_init(sccb_shadow_t *shadow, size_t size, const sccb_shadow_range_t *volatile_ranges, size_t num_volatile)
+{
+    if (size == 0 || (size & (size - 1))) {
+        return false;
+    }
+    if (shadow->entries && shadow->size != size) {
+        sccb_shadow_deinit(shadow);
+    }
+    if (!shadow->entries) {
+        shadow->entries = calloc(size, sizeof(sccb_shadow_entry_t));
+        if (!shadow->entries) {
+            return false;
+        }
+    }
+    shadow->size = size;
+    shadow->volatile_ranges = volatile_ranges;
+    shadow->num_volatile = num_volatile;
+    sccb_shadow_clear(shadow);
+    return true;
+}
+
+void sccb_shadow_deinit(sccb_shadow_t *shadow)
+{
+    free(shadow->entries);
+    shadow->entries = NULL;
+    shadow->size = 0;
+    shadow->count = 0;
+}
+
+void sccb_shadow_clear(sccb_shadow_t *shadow)
+{
+    if (shadow->entries) {
+        memset(shadow->entries, 0, shadow->size * sizeof(sccb_shadow_entry_t));
+    }
+    shadow->count = 0;
+}
+
+bool sccb_shadow_get(const sccb_shadow_t *shadow, uint16_t reg, uint8_t *value)
+{
+    if (!shadow->entries) {
+        return false;
+    }
+    const sccb_shadow_entry_t *entry = find(shadow, reg);
+    if (!entry->used) {
+        return false;
+    }
+    *value = entry->value;
+    return true;
+}
+
+void sccb_shadow_set(sccb_shadow_t *shadow, uint16_t reg, uint8_t value)
+{
+    if (!shadow->entries || is_volatile(shadow, reg)) {
+        return;
+    }
+    sccb_shadow_entry_t *entry = find(shadow, reg);
+    if (!entry->used) {
+        //keep probe chains short, the registers touched after init are usually cached by then
+        if (shadow->count >= shadow->size / 4 * 3) {
+            return;
+        }
+        entry->used = 1;
+        entry->reg = reg;
+        shadow->count++;
+    }
+    entry->value = value;
+}
@@ -90,12 +90,19 @@ static int set_reg_bits(uint8_t slv_addr, uint16_t reg, uint8_t offset, uint8_t
 
 static int write_regs(uint8_t slv_addr, const uint16_t (*regs)[2])
 {
-    int i = 0, ret = 0;
-    while (!ret && regs[i][0] != REGLIST_TAIL) {
+    int i = 0, first = 0, ret = 0;
+    //the writes between two delays go out in batches straight from the table
+    while (!ret) {
+        if (regs[i][0] == REG_DLY || regs[i][0] == REGLIST_TAIL || i - first == SCCB_BATCH_MAX) {
+            ret = SCCB_WriteBatch(slv_addr, &regs[first], i - first);
+            first = i;
+        }
+        if (ret || regs[i][0] == REGLIST_TAIL) {
+            break;
+        }
         if (regs[i][0] == REG_DLY) {
             vTaskDelay(regs[i][1] / portTICK_PERIOD_MS);
-        } else {
-            ret = write_reg(slv_addr, regs[i][0], regs[i][1]);
+            first = i + 1;
         }
         i++;
     }
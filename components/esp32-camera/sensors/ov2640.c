@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "sccb.h"
+#include "sccb_shadow.h"
 #include "xclk.h"
 #include "ov2640.h"
 #include "ov2640_regs.h"
@@ -24,6 +25,36 @@
 static const char* TAG = "ov2640";
 #endif
 
+#define SHADOW_SIZE 512
+#define SHADOW_REG(bank, reg) (((bank) << 8) | (reg))
+
+//registers the sensor rewrites itself, COM7 also holds the self-clearing reset bit
+static const sccb_shadow_range_t volatile_regs[] = {
+    {SHADOW_REG(BANK_SENSOR, GAIN), SHADOW_REG(BANK_SENSOR, GAIN)},
+    {SHADOW_REG(BANK_SENSOR, REG04), SHADOW_REG(BANK_SENSOR, REG04)},
+    {SHADOW_REG(BANK_SENSOR, AEC), SHADOW_REG(BANK_SENSOR, AEC)},
+    {SHADOW_REG(BANK_SENSOR, COM7), SHADOW_REG(BANK_SENSOR, COM7)},
+    {SHADOW_REG(BANK_SENSOR, REG45), SHADOW_REG(BANK_SENSOR, REG45)},
+};
+
+static sccb_shadow_t shadow;
+
+#define WINDOW_REGS 11
+#define PRESET_MAX_REGS 64
+
+//what set_window writes for one frame size, less the resets and the sensor mode itself
+typedef struct {
+    framesize_t framesize;
+    ov2640_sensor_mode_t mode;
+    uint8_t regs[PRESET_MAX_REGS][2];
+} mode_preset_t;
+
+static mode_preset_t *presets;
+static int num_presets;
+static pixformat_t presets_pixformat;
+//sensor mode of the last set_window, unknown after a reset
+static ov2640_sensor_mode_t current_mode = OV2640_MODE_MAX;
+
 static volatile ov2640_bank_t reg_bank = BANK_MAX;
 static int set_bank(sensor_t *sensor, ov2640_bank_t bank)
 {
@@ -35,28 +66,75 @@ static int set_bank(sensor_t *sensor, ov2640_bank_t bank)
     return res;
 }
 
+//write to the selected bank, unless the register is known to hold the value already
+static int write_bank_reg(sensor_t *sensor, uint8_t reg, uint8_t value)
+{
+    //nothing is known about the registers before the first bank is selected
+    bool shadowed = reg_bank < BANK_MAX;
+    uint8_t cached;
+    if (shadowed && sccb_shadow_get(&shadow, SHADOW_REG(reg_bank, reg), &cached) && cached == value) {
+        return 0;
+    }
+    int ret = SCCB_Write(sensor->slv_addr, reg, value);
+    if (ret) {
+        sccb_shadow_clear(&shadow);
+    } else if (shadowed) {
+        sccb_shadow_set(&shadow, SHADOW_REG(reg_bank, reg), value);
+    }
+    return ret;
+}
+
+static int flush_regs(sensor_t *sensor, uint16_t (*batch)[2], size_t *count)
+{
+    int res = SCCB_WriteBatch(sensor->slv_addr, (const uint16_t (*)[2])batch, *count);
+    if (res) {
+        //which bank ended up selected is unknown as well
+        reg_bank = BANK_MAX;
+        sccb_shadow_clear(&shadow);
+    }
+    *count = 0;
+    return res;
+}
+
 static int write_regs(sensor_t *sensor, const uint8_t (*regs)[2])
 {
+    uint16_t batch[SCCB_BATCH_MAX][2];
+    size_t count = 0;
+    uint8_t cached;
     int i=0, res = 0;
     while (regs[i][0]) {
-        if (regs[i][0] == BANK_SEL) {
-            res = set_bank(sensor, regs[i][1]);
+        uint8_t reg = regs[i][0], value = regs[i][1];
+        bool queue;
+        if (reg == BANK_SEL) {
+            queue = value != reg_bank;
+            reg_bank = value;
         } else {
-            res = SCCB_Write(sensor->slv_addr, regs[i][0], regs[i][1]);
+            //nothing is known about the registers before the first bank is selected
+            queue = reg_bank >= BANK_MAX || !sccb_shadow_get(&shadow, SHADOW_REG(reg_bank, reg), &cached) || cached != value;
+            if (queue && reg_bank < BANK_MAX) {
+                sccb_shadow_set(&shadow, SHADOW_REG(reg_bank, reg), value);
+            }
+        }
+        if (queue) {
+            batch[count][0] = reg;
+            batch[count][1] = value;
+            if (++count == SCCB_BATCH_MAX) {
+                res = flush_regs(sensor, batch, &count);
+            }
         }
         if (res) {
             return res;
         }
         i++;
     }
-    return res;
+    return flush_regs(sensor, batch, &count);
 }
 
 static int write_reg(sensor_t *sensor, ov2640_bank_t bank, uint8_t reg, uint8_t value)
 {
     int ret = set_bank(sensor, bank);
     if(!ret) {
-        ret = SCCB_Write(sensor->slv_addr, reg, value);
+        ret = write_bank_reg(sensor, reg, value);
     }
     return ret;
 }
@@ -70,9 +148,11 @@ static int set_reg_bits(sensor_t *sensor, uint8_t bank, uint8_t reg, uint8_t off
     if(ret) {
         return ret;
     }
-    c_value = SCCB_Read(sensor->slv_addr, reg);
+    if (!sccb_shadow_get(&shadow, SHADOW_REG(bank, reg), &c_value)) {
+        c_value = SCCB_Read(sensor->slv_addr, reg);
+    }
     new_value = (c_value & ~(mask << offset)) | ((value & mask) << offset);
-    ret = SCCB_Write(sensor->slv_addr, reg, new_value);
+    ret = write_bank_reg(sensor, reg, new_value);
     return ret;
 }
 
@@ -86,7 +166,16 @@ static int read_reg(sensor_t *sensor, ov2640_bank_t bank, uint8_t reg)
 
 static uint8_t get_reg_bits(sensor_t *sensor, uint8_t bank, uint8_t reg, uint8_t offset, uint8_t mask)
 {
-    return (read_reg(sensor, bank, reg) >> offset) & mask;
+    uint8_t value;
+    if (sccb_shadow_get(&shadow, SHADOW_REG(bank, reg), &value)) {
+        return (value >> offset) & mask;
+    }
+    if (set_bank(sensor, bank)) {
+        return 0;
+    }
+    value = SCCB_Read(sensor->slv_addr, reg);
+    sccb_shadow_set(&shadow, SHADOW_REG(bank, reg), value);
+    return (value >> offset) & mask;
 }
 
 static int write_reg_bits(sensor_t *sensor, uint8_t bank, uint8_t reg, uint8_t mask, int enable)
@@ -101,6 +190,8 @@ static int write_reg_bits(sensor_t *sensor, uint8_t bank, uint8_t reg, uint8_t m
 static int reset(sensor_t *sensor)
 {
     int ret = 0;
+    sccb_shadow_clear(&shadow);
+    current_mode = OV2640_MODE_MAX;
     WRITE_REG_OR_RETURN(BANK_SENSOR, COM7, COM7_SRST);
     vTaskDelay(10 / portTICK_PERIOD_MS);
     WRITE_REGS_OR_RETURN(ov2640_settings_cif);
@@ -134,9 +225,19 @@ static int set_pixformat(sensor_t *sensor, pixformat_t pixformat)
     return ret;
 }
 
-static int set_window(sensor_t *sensor, ov2640_sensor_mode_t mode, int offset_x, int offset_y, int max_x, int max_y, int w, int h){
-    int ret = 0;
-    const uint8_t (*regs)[2];
+static const uint8_t (*get_mode_regs(ov2640_sensor_mode_t mode))[2]
+{
+    if (mode == OV2640_MODE_CIF) {
+        return ov2640_settings_to_cif;
+    } else if (mode == OV2640_MODE_SVGA) {
+        return ov2640_settings_to_svga;
+    }
+    return ov2640_settings_to_uxga;
+}
+
+static void get_window(sensor_t *sensor, ov2640_sensor_mode_t mode, int offset_x, int offset_y, int max_x, int max_y, int w, int h,
+                       uint8_t win_regs[WINDOW_REGS][2], ov2640_clk_t *clk)
+{
     ov2640_clk_t c;
     c.reserved = 0;
 
@@ -144,7 +245,7 @@ static int set_window(sensor_t *sensor, ov2640_sensor_mode_t mode, int offset_x,
     max_y /= 4;
     w /= 4;
     h /= 4;
-    uint8_t win_regs[][2] = {
+    const uint8_t regs[WINDOW_REGS][2] = {
         {BANK_SEL, BANK_DSP},
         {HSIZE, max_x & 0xFF},
         {VSIZE, max_y & 0xFF},
@@ -157,6 +258,7 @@ static int set_window(sensor_t *sensor, ov2640_sensor_mode_t mode, int offset_x,
         {ZMHH, ((h>>6)&0x04)|((w>>8)&0x03)},
         {0, 0}
     };
+    memcpy(win_regs, regs, sizeof(regs));
 
     if (sensor->pixformat == PIXFORMAT_JPEG) {
         c.clk_2x = 0;
@@ -184,19 +286,21 @@ static int set_window(sensor_t *sensor, ov2640_sensor_mode_t mode, int offset_x,
             c.pclk_div = 12;
         }
     }
-    ESP_LOGI(TAG, "Set PLL: clk_2x: %u, clk_div: %u, pclk_auto: %u, pclk_div: %u", c.clk_2x, c.clk_div, c.pclk_auto, c.pclk_div);
+    *clk = c;
+}
 
-    if (mode == OV2640_MODE_CIF) {
-        regs = ov2640_settings_to_cif;
-    } else if (mode == OV2640_MODE_SVGA) {
-        regs = ov2640_settings_to_svga;
-    } else {
-        regs = ov2640_settings_to_uxga;
-    }
+static int set_window(sensor_t *sensor, ov2640_sensor_mode_t mode, int offset_x, int offset_y, int max_x, int max_y, int w, int h){
+    int ret = 0;
+    uint8_t win_regs[WINDOW_REGS][2];
+    ov2640_clk_t c;
+
+    get_window(sensor, mode, offset_x, offset_y, max_x, max_y, w, h, win_regs, &c);
+    ESP_LOGI(TAG, "Set PLL: clk_2x: %u, clk_div: %u, pclk_auto: %u, pclk_div: %u", c.clk_2x, c.clk_div, c.pclk_auto, c.pclk_div);
 
+    current_mode = OV2640_MODE_MAX;
     WRITE_REG_OR_RETURN(BANK_DSP, R_BYPASS, R_BYPASS_DSP_BYPAS);
-    WRITE_REGS_OR_RETURN(regs);
-    WRITE_REGS_OR_RETURN(win_regs);
+    WRITE_REGS_OR_RETURN(get_mode_regs(mode));
+    WRITE_REGS_OR_RETURN((const uint8_t (*)[2])win_regs);
     WRITE_REG_OR_RETURN(BANK_SENSOR, CLKRC, c.clk);
     WRITE_REG_OR_RETURN(BANK_DSP, R_DVP_SP, c.pclk);
     WRITE_REG_OR_RETURN(BANK_DSP, R_BYPASS, R_BYPASS_DSP_EN);
@@ -204,47 +308,149 @@ static int set_window(sensor_t *sensor, ov2640_sensor_mode_t mode, int offset_x,
     vTaskDelay(10 / portTICK_PERIOD_MS);
     //required when changing resolution
     set_pixformat(sensor, sensor->pixformat);
+    current_mode = mode;
 
     return ret;
 }
 
-static int set_framesize(sensor_t *sensor, framesize_t framesize)
+static ov2640_sensor_mode_t get_framesize_window(framesize_t framesize, int *offset_x, int *offset_y, int *max_x, int *max_y)
 {
-    int ret = 0;
-    uint16_t w = resolution[framesize].width;
-    uint16_t h = resolution[framesize].height;
     aspect_ratio_t ratio = resolution[framesize].aspect_ratio;
-    uint16_t max_x = ratio_table[ratio].max_x;
-    uint16_t max_y = ratio_table[ratio].max_y;
-    uint16_t offset_x = ratio_table[ratio].offset_x;
-    uint16_t offset_y = ratio_table[ratio].offset_y;
-    ov2640_sensor_mode_t mode = OV2640_MODE_UXGA;
+    *max_x = ratio_table[ratio].max_x;
+    *max_y = ratio_table[ratio].max_y;
+    *offset_x = ratio_table[ratio].offset_x;
+    *offset_y = ratio_table[ratio].offset_y;
 
-    sensor->status.framesize = framesize;
+    if (framesize <= FRAMESIZE_CIF) {
+        *max_x /= 4;
+        *max_y /= 4;
+        *offset_x /= 4;
+        *offset_y /= 4;
+        if(*max_y > 296){
+            *max_y = 296;
+        }
+        return OV2640_MODE_CIF;
+    } else if (framesize <= FRAMESIZE_SVGA) {
+        *max_x /= 2;
+        *max_y /= 2;
+        *offset_x /= 2;
+        *offset_y /= 2;
+        return OV2640_MODE_SVGA;
+    }
+    return OV2640_MODE_UXGA;
+}
 
+static int add_preset_reg(mode_preset_t *preset, int *count, uint8_t reg, uint8_t value)
+{
+    //the last entry stays zero to end the list
+    if (*count >= PRESET_MAX_REGS - 1) {
+        return -1;
+    }
+    preset->regs[*count][0] = reg;
+    preset->regs[*count][1] = value;
+    (*count)++;
+    return 0;
+}
 
+static int build_preset(sensor_t *sensor, framesize_t framesize, mode_preset_t *preset)
+{
+    int offset_x, offset_y, max_x, max_y, count = 0, ret = 0;
+    uint8_t win_regs[WINDOW_REGS][2];
+    ov2640_clk_t c;
 
-    if (framesize <= FRAMESIZE_CIF) {
-        mode = OV2640_MODE_CIF;
-        max_x /= 4;
-        max_y /= 4;
-        offset_x /= 4;
-        offset_y /= 4;
-        if(max_y > 296){
-            max_y = 296;
+    preset->framesize = framesize;
+    preset->mode = get_framesize_window(framesize, &offset_x, &offset_y, &max_x, &max_y);
+    get_window(sensor, preset->mode, offset_x, offset_y, max_x, max_y,
+               resolution[framesize].width, resolution[framesize].height, win_regs, &c);
+
+    //COM7 selects the sensor mode, which a preset is only used within. apply_preset resets the DSP itself
+    const uint8_t (*regs)[2] = get_mode_regs(preset->mode);
+    uint8_t bank = BANK_MAX;
+    for (int i = 0; !ret && regs[i][0]; i++) {
+        if (regs[i][0] == BANK_SEL) {
+            bank = regs[i][1];
+        } else if ((bank == BANK_SENSOR && regs[i][0] == COM7) || (bank == BANK_DSP && regs[i][0] == RESET)) {
+            continue;
         }
-    } else if (framesize <= FRAMESIZE_SVGA) {
-        mode = OV2640_MODE_SVGA;
-        max_x /= 2;
-        max_y /= 2;
-        offset_x /= 2;
-        offset_y /= 2;
+        ret = add_preset_reg(preset, &count, regs[i][0], regs[i][1]);
     }
+    for (int i = 0; !ret && win_regs[i][0]; i++) {
+        ret = add_preset_reg(preset, &count, win_regs[i][0], win_regs[i][1]);
+    }
+    ret = ret
+          || add_preset_reg(preset, &count, BANK_SEL, BANK_SENSOR)
+          || add_preset_reg(preset, &count, CLKRC, c.clk)
+          || add_preset_reg(preset, &count, BANK_SEL, BANK_DSP)
+          || add_preset_reg(preset, &count, R_DVP_SP, c.pclk);
+    return ret;
+}
+
+static const mode_preset_t *find_preset(sensor_t *sensor, framesize_t framesize)
+{
+    if (sensor->pixformat != presets_pixformat) {
+        return NULL;
+    }
+    for (int i = 0; i < num_presets; i++) {
+        if (presets[i].framesize == framesize) {
+            return &presets[i];
+        }
+    }
+    return NULL;
+}
+
+//the sensor keeps running in the same mode, only the DSP window, scaler and clocks change
+static int apply_preset(sensor_t *sensor, const mode_preset_t *preset)
+{
+    int ret = 0;
+    uint8_t reset = sensor->pixformat == PIXFORMAT_JPEG ? RESET_JPEG | RESET_DVP : RESET_DVP;
 
-    ret = set_window(sensor, mode, offset_x, offset_y, max_x, max_y, w, h);
+    WRITE_REG_OR_RETURN(BANK_DSP, R_BYPASS, R_BYPASS_DSP_BYPAS);
+    WRITE_REG_OR_RETURN(BANK_DSP, RESET, reset);
+    WRITE_REGS_OR_RETURN(preset->regs);
+    WRITE_REG_OR_RETURN(BANK_DSP, R_BYPASS, R_BYPASS_DSP_EN);
+    WRITE_REG_OR_RETURN(BANK_DSP, RESET, 0x00);
     return ret;
 }
 
+static int set_mode_presets(sensor_t *sensor, const framesize_t *framesizes, int count)
+{
+    free(presets);
+    presets = NULL;
+    num_presets = 0;
+    if (count <= 0) {
+        return 0;
+    }
+
+    presets = calloc(count, sizeof(mode_preset_t));
+    if (!presets) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        if (framesizes[i] > FRAMESIZE_UXGA || build_preset(sensor, framesizes[i], &presets[i])) {
+            ESP_LOGE(TAG, "No preset for frame size %d", framesizes[i]);
+            free(presets);
+            presets = NULL;
+            return -1;
+        }
+    }
+    num_presets = count;
+    presets_pixformat = sensor->pixformat;
+    return 0;
+}
+
+static int set_framesize(sensor_t *sensor, framesize_t framesize)
+{
+    int offset_x, offset_y, max_x, max_y;
+    ov2640_sensor_mode_t mode = get_framesize_window(framesize, &offset_x, &offset_y, &max_x, &max_y);
+    const mode_preset_t *preset = find_preset(sensor, framesize);
+
+    sensor->status.framesize = framesize;
+    if (preset && preset->mode == current_mode) {
+        return apply_preset(sensor, preset);
+    }
+    return set_window(sensor, mode, offset_x, offset_y, max_x, max_y, resolution[framesize].width, resolution[framesize].height);
+}
+
 static int set_contrast(sensor_t *sensor, int level)
 {
     int ret=0;
@@ -503,6 +709,31 @@ static int set_xclk(sensor_t *sensor, int timer, int xclk)
     return ret;
 }
 
+static int get_agc_gain_index(sensor_t *sensor)
+{
+    int agc_gain = read_reg(sensor, BANK_SENSOR, GAIN);
+    for (int i=0; i<30; i++){
+        if(agc_gain >= agc_gain_tbl[i] && agc_gain < agc_gain_tbl[i+1]){
+            return i;
+        }
+    }
+    return 30;
+}
+
+static int get_aec_value(sensor_t *sensor)
+{
+    return ((uint16_t)get_reg_bits(sensor, BANK_SENSOR, REG45, 0, 0x3F) << 10)
+         | ((uint16_t)read_reg(sensor, BANK_SENSOR, AEC) << 2)
+         | get_reg_bits(sensor, BANK_SENSOR, REG04, 0, 3);//0 - 1200
+}
+
+static int get_aec_agc(sensor_t *sensor, int *aec_value, int *agc_gain)
+{
+    *aec_value = get_aec_value(sensor);
+    *agc_gain = get_agc_gain_index(sensor);
+    return 0;
+}
+
 static int init_status(sensor_t *sensor){
     sensor->status.brightness = 0;
     sensor->status.contrast = 0;
@@ -511,18 +742,8 @@ static int init_status(sensor_t *sensor){
     sensor->status.special_effect = 0;
     sensor->status.wb_mode = 0;
 
-    sensor->status.agc_gain = 30;
-    int agc_gain = read_reg(sensor, BANK_SENSOR, GAIN);
-    for (int i=0; i<30; i++){
-        if(agc_gain >= agc_gain_tbl[i] && agc_gain < agc_gain_tbl[i+1]){
-            sensor->status.agc_gain = i;
-            break;
-        }
-    }
-
-    sensor->status.aec_value = ((uint16_t)get_reg_bits(sensor, BANK_SENSOR, REG45, 0, 0x3F) << 10)
-                             | ((uint16_t)read_reg(sensor, BANK_SENSOR, AEC) << 2)
-                             | get_reg_bits(sensor, BANK_SENSOR, REG04, 0, 3);//0 - 1200
+    sensor->status.agc_gain = get_agc_gain_index(sensor);
+    sensor->status.aec_value = get_aec_value(sensor);
     sensor->status.quality = read_reg(sensor, BANK_DSP, QS);
     sensor->status.gainceiling = get_reg_bits(sensor, BANK_SENSOR, COM9, 5, 7);
 
@@ -565,6 +786,11 @@ int ov2640_detect(int slv_addr, sensor_id_t *id)
 
 int ov2640_init(sensor_t *sensor)
 {
+#if CONFIG_SCCB_REGISTER_SHADOW
+    if (!sccb_shadow_init(&shadow, SHADOW_SIZE, volatile_regs, sizeof(volatile_regs) / sizeof(volatile_regs[0]))) {
+        ESP_LOGW(TAG, "No memory for the register shadow");
+    }
+#endif
     sensor->reset = reset;
     sensor->init_status = init_status;
     sensor->set_pixformat = set_pixformat;
@@ -607,6 +833,8 @@ int ov2640_init(sensor_t *sensor)
     sensor->set_res_raw = set_res_raw;
     sensor->set_pll = _set_pll;
     sensor->set_xclk = set_xclk;
+    sensor->get_aec_agc = get_aec_agc;
+    sensor->set_mode_presets = set_mode_presets;
     ESP_LOGD(TAG, "OV2640 Attached");
     return 0;
 }
@@ -594,6 +594,13 @@ static int get_aec_value(sensor_t *sensor)
     return res;
 }
 
+static int get_aec_agc(sensor_t *sensor, int *aec_value, int *agc_gain)
+{
+    *aec_value = get_aec_value(sensor);
+    *agc_gain = get_agc_gain(sensor);
+    return 0;
+}
+
 static int set_aec_value(sensor_t *sensor, int value)
 {
     int ret = 0, max_val = 0;
@@ -1049,5 +1056,6 @@ int ov3660_init(sensor_t *sensor)
     sensor->set_res_raw = set_res_raw;
     sensor->set_pll = _set_pll;
     sensor->set_xclk = set_xclk;
+    sensor->get_aec_agc = get_aec_agc;
     return 0;
 }
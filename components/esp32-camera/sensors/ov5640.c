@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "sccb.h"
+#include "sccb_shadow.h"
 #include "xclk.h"
 #include "ov5640.h"
 #include "ov5640_regs.h"
@@ -26,6 +27,19 @@ static const char *TAG = "ov5640";
 
 //#define REG_DEBUG_ON
 
+#define SHADOW_SIZE 512
+
+//registers written to trigger something, or rewritten by the sensor itself
+static const sccb_shadow_range_t volatile_regs[] = {
+    {0x3000, 0x3002},                   //block resets
+    {SYSTEM_CTROL0, SYSTEM_CTROL0},     //software reset and power down
+    {0x3400, 0x3405},                   //AWB gains
+    {0x3500, 0x3502},                   //AEC exposure
+    {0x350A, 0x350B},                   //AGC gain
+};
+
+static sccb_shadow_t shadow;
+
 static int read_reg(uint8_t slv_addr, const uint16_t reg){
     int ret = SCCB_Read16(slv_addr, reg);
 #ifdef REG_DEBUG_ON
@@ -36,8 +50,20 @@ static int read_reg(uint8_t slv_addr, const uint16_t reg){
     return ret;
 }
 
+static int read_reg_shadowed(uint8_t slv_addr, const uint16_t reg){
+    uint8_t value;
+    if (sccb_shadow_get(&shadow, reg, &value)) {
+        return value;
+    }
+    int ret = read_reg(slv_addr, reg);
+    if (ret >= 0) {
+        sccb_shadow_set(&shadow, reg, ret);
+    }
+    return ret;
+}
+
 static int check_reg_mask(uint8_t slv_addr, uint16_t reg, uint8_t mask){
-    return (read_reg(slv_addr, reg) & mask) == mask;
+    return (read_reg_shadowed(slv_addr, reg) & mask) == mask;
 }
 
 static int read_reg16(uint8_t slv_addr, const uint16_t reg){
@@ -107,6 +133,10 @@ static int read_reg16(uint8_t slv_addr, const uint16_t reg){
 
 static int write_reg(uint8_t slv_addr, const uint16_t reg, uint8_t value){
     int ret = 0;
+    uint8_t cached;
+    if (sccb_shadow_get(&shadow, reg, &cached) && cached == value) {
+        return 0;
+    }
 #ifndef REG_DEBUG_ON
     ret = SCCB_Write16(slv_addr, reg, value);
 #else
@@ -125,6 +155,12 @@ static int write_reg(uint8_t slv_addr, const uint16_t reg, uint8_t value){
         ESP_LOGE(TAG, "WRITE REG 0x%04x FAILED: %d", reg, ret);
     }
 #endif
+    if (ret) {
+        //the register may or may not have changed
+        sccb_shadow_clear(&shadow);
+    } else {
+        sccb_shadow_set(&shadow, reg, value);
+    }
     return ret;
 }
 
@@ -132,7 +168,7 @@ static int set_reg_bits(uint8_t slv_addr, uint16_t reg, uint8_t offset, uint8_t
 {
     int ret = 0;
     uint8_t c_value, new_value;
-    ret = read_reg(slv_addr, reg);
+    ret = read_reg_shadowed(slv_addr, reg);
     if(ret < 0) {
         return ret;
     }
@@ -142,17 +178,43 @@ static int set_reg_bits(uint8_t slv_addr, uint16_t reg, uint8_t offset, uint8_t
     return ret;
 }
 
+static int flush_regs(uint8_t slv_addr, uint16_t (*batch)[2], size_t *count)
+{
+    //runs of consecutive registers are sent with address auto-increment
+    int ret = SCCB_WriteBatch16(slv_addr, (const uint16_t (*)[2])batch, *count, true);
+    if (ret) {
+        sccb_shadow_clear(&shadow);
+    }
+    *count = 0;
+    return ret;
+}
+
 static int write_regs(uint8_t slv_addr, const uint16_t (*regs)[2])
 {
+    uint16_t batch[SCCB_BATCH_MAX][2];
+    size_t count = 0;
+    uint8_t cached;
     int i = 0, ret = 0;
     while (!ret && regs[i][0] != REGLIST_TAIL) {
         if (regs[i][0] == REG_DLY) {
-            vTaskDelay(regs[i][1] / portTICK_PERIOD_MS);
-        } else {
-            ret = write_reg(slv_addr, regs[i][0], regs[i][1]);
+            ret = flush_regs(slv_addr, batch, &count);
+            if (!ret) {
+                vTaskDelay(regs[i][1] / portTICK_PERIOD_MS);
+            }
+        } else if (!sccb_shadow_get(&shadow, regs[i][0], &cached) || cached != regs[i][1]) {
+            //recorded right away, so a later write of the same register within the batch compares against it
+            sccb_shadow_set(&shadow, regs[i][0], regs[i][1]);
+            batch[count][0] = regs[i][0];
+            batch[count][1] = regs[i][1];
+            if (++count == SCCB_BATCH_MAX) {
+                ret = flush_regs(slv_addr, batch, &count);
+            }
         }
         i++;
     }
+    if (!ret) {
+        ret = flush_regs(slv_addr, batch, &count);
+    }
     return ret;
 }
 
@@ -253,6 +315,7 @@ static int reset(sensor_t *sensor)
     vTaskDelay(100 / portTICK_PERIOD_MS);
     int ret = 0;
     // Software Reset: clear all registers and reset them to their default values
+    sccb_shadow_clear(&shadow);
     ret = write_reg(sensor->slv_addr, SYSTEM_CTROL0, 0x82);
     if(ret){
         ESP_LOGE(TAG, "Software Reset FAILED!");
@@ -669,6 +732,13 @@ static int get_aec_value(sensor_t *sensor)
     return res;
 }
 
+static int get_aec_agc(sensor_t *sensor, int *aec_value, int *agc_gain)
+{
+    *aec_value = get_aec_value(sensor);
+    *agc_gain = get_agc_gain(sensor);
+    return 0;
+}
+
 static int set_aec_value(sensor_t *sensor, int value)
 {
     int ret = 0, max_val = 0;
@@ -1091,6 +1161,11 @@ int ov5640_detect(int slv_addr, sensor_id_t *id)
 
 int ov5640_init(sensor_t *sensor)
 {
+#if CONFIG_SCCB_REGISTER_SHADOW
+    if (!sccb_shadow_init(&shadow, SHADOW_SIZE, volatile_regs, sizeof(volatile_regs) / sizeof(volatile_regs[0]))) {
+        ESP_LOGW(TAG, "No memory for the register shadow");
+    }
+#endif
     sensor->reset = reset;
     sensor->set_pixformat = set_pixformat;
     sensor->set_framesize = set_framesize;
@@ -1126,5 +1201,6 @@ int ov5640_init(sensor_t *sensor)
     sensor->set_res_raw = set_res_raw;
     sensor->set_pll = _set_pll;
     sensor->set_xclk = set_xclk;
+    sensor->get_aec_agc = get_aec_agc;
     return 0;
 }
@@ -34,6 +34,7 @@
 #include "freertos/queue.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
+#include "cam_arena.h"
 
 #if __has_include("esp_private/periph_ctrl.h")
 # include "esp_private/periph_ctrl.h"
@@ -80,6 +81,10 @@ typedef struct {
     //for RGB/YUV modes
     lldesc_t *dma;
     size_t fb_offset;
+    //for JPEG mode, offset of the last EOI seen by cam_task, -1 if none
+    int eoi_offset;
+    //for the JPEG frame pool, block holding fb.buf, -1 if none
+    int arena_block;
 } cam_frame_t;
 
 typedef struct {
@@ -126,6 +131,10 @@ typedef struct {
 #endif
     uint32_t fb_size;
 
+    //JPEG frame pool, frames packed back to back in one buffer
+    bool fb_pool;
+    cam_arena_t arena;
+
     cam_state_t state;
 } cam_obj_t;
 
@@ -0,0 +1,204 @@
+// Host microbenchmark of the JPEG marker scanners against the byte-at-a-time ones they replaced.
+//
+// Every test picture is padded the way cam_task leaves frames (DMA chunks past the EOI) and scanned
+// with both implementations; the results have to match. A randomized sweep also checks the
+// word-at-a-time scanners against a plain byte loop at every alignment.
+//
+// "eoi tracked" is the chunk by chunk scan cam_task now runs while copying. It reads every byte of the
+// frame, while the backwards scans only read the padding after the EOI, so it is the slowest column by
+// far. It is what lets cam_task hand a frame over at its EOI instead of at VSYNC.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "jpeg_markers.h"
+
+#define DMA_HALF_BUFFER_SIZE 4096
+#define ITERATIONS 200
+
+static const char *pictures[] = { "testimg.jpeg", "test_outside.jpeg", "test_inside.jpeg" };
+
+// The previous cam_hal scanners, verbatim apart from the logging
+static const uint32_t JPEG_SOI_MARKER = 0xFFD8FF;
+static const uint16_t JPEG_EOI_MARKER = 0xD9FF;
+
+static int legacy_verify_jpeg_soi(const uint8_t *inbuf, uint32_t length)
+{
+    uint32_t sig = *((uint32_t *)inbuf) & 0xFFFFFF;
+    if(sig != JPEG_SOI_MARKER) {
+        for (uint32_t i = 0; i < length; i++) {
+            sig = *((uint32_t *)(&inbuf[i])) & 0xFFFFFF;
+            if (sig == JPEG_SOI_MARKER) {
+                return i;
+            }
+        }
+        return -1;
+    }
+    return 0;
+}
+
+static int legacy_verify_jpeg_eoi(const uint8_t *inbuf, uint32_t length)
+{
+    uint8_t *dptr = (uint8_t *)inbuf + length - 2;
+    while (dptr > inbuf) {
+        uint16_t sig = *((uint16_t *)dptr);
+        if (JPEG_EOI_MARKER == sig) {
+            return dptr - inbuf;
+        }
+        dptr--;
+    }
+    return -1;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint8_t *load_frame(const char *path, size_t *frame_length, size_t *picture_length)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror(path);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    // Round up to whole DMA chunks; the extra 4 bytes keep the legacy SOI scan's overread in bounds
+    size_t length = (size + DMA_HALF_BUFFER_SIZE - 1) / DMA_HALF_BUFFER_SIZE * DMA_HALF_BUFFER_SIZE;
+    uint8_t *frame = calloc(1, length + 4);
+    if (fread(frame, 1, size, file) != (size_t)size) {
+        perror(path);
+        free(frame);
+        frame = NULL;
+    }
+    fclose(file);
+
+    *frame_length = length;
+    *picture_length = size;
+    return frame;
+}
+
+static double time_scan(int (*scan)(const uint8_t *, uint32_t), const uint8_t *buf, uint32_t length, int *result)
+{
+    double start = now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+        *result = scan(buf, length);
+        __asm__ volatile("" ::: "memory");
+    }
+    return (now_ns() - start) / ITERATIONS;
+}
+
+static int swar_soi(const uint8_t *buf, uint32_t length)
+{
+    return jpeg_find_soi(buf, length);
+}
+
+static int swar_eoi(const uint8_t *buf, uint32_t length)
+{
+    return jpeg_find_last_eoi(buf, length);
+}
+
+// Chunk by chunk as cam_task does it, overlapping one byte with the previous chunk
+static int tracked_eoi(const uint8_t *buf, uint32_t length)
+{
+    int eoi = -1;
+    for (size_t start = 0; start < length; start += DMA_HALF_BUFFER_SIZE) {
+        size_t from = start ? start - 1 : 0;
+        size_t end = start + DMA_HALF_BUFFER_SIZE < length ? start + DMA_HALF_BUFFER_SIZE : length;
+        int offset = jpeg_find_last_eoi(&buf[from], end - from);
+        if (offset >= 0) {
+            eoi = from + offset;
+        }
+    }
+    return eoi;
+}
+
+static int naive_soi(const uint8_t *buf, size_t length)
+{
+    for (size_t i = 0; i + 2 < length; i++) {
+        if (buf[i] == 0xFF && buf[i + 1] == 0xD8 && buf[i + 2] == 0xFF) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int naive_eoi(const uint8_t *buf, size_t length)
+{
+    for (size_t i = length; i >= 2; i--) {
+        if (buf[i - 2] == 0xFF && buf[i - 1] == 0xD9) {
+            return i - 2;
+        }
+    }
+    return -1;
+}
+
+static bool check_random_buffers(void)
+{
+    static uint8_t storage[256 + 8];
+    srand(1);
+    for (int round = 0; round < 20000; round++) {
+        size_t offset = rand() % 8;
+        size_t length = rand() % 256;
+        uint8_t *buf = &storage[offset];
+        for (size_t i = 0; i < length; i++) {
+            // Mostly 0xFF and marker bytes, so markers land on every alignment and word boundary
+            static const uint8_t bytes[] = { 0xFF, 0xD8, 0xD9, 0x00, 0x12 };
+            buf[i] = bytes[rand() % sizeof(bytes)];
+        }
+
+        if (jpeg_find_soi(buf, length) != naive_soi(buf, length)
+                || jpeg_find_last_eoi(buf, length) != naive_eoi(buf, length)) {
+            fprintf(stderr, "Mismatch at round %d, length %zu, offset %zu\n", round, length, offset);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = argc > 1 ? argv[1] : "../pictures";
+    bool ok = check_random_buffers();
+
+    printf("%-18s %8s %12s %12s %12s %12s %12s\n", "picture", "bytes",
+           "soi legacy", "soi swar", "eoi legacy", "eoi swar", "eoi tracked");
+    for (size_t p = 0; p < sizeof(pictures) / sizeof(pictures[0]); p++) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s/%s", dir, pictures[p]);
+        size_t length, picture_length;
+        uint8_t *frame = load_frame(path, &length, &picture_length);
+        if (!frame) {
+            return 2;
+        }
+
+        int soi_legacy, soi_swar, eoi_legacy, eoi_swar, eoi_tracked;
+        double t_soi_legacy = time_scan(legacy_verify_jpeg_soi, frame, length, &soi_legacy);
+        double t_soi_swar = time_scan(swar_soi, frame, length, &soi_swar);
+        double t_eoi_legacy = time_scan(legacy_verify_jpeg_eoi, frame, length, &eoi_legacy);
+        double t_eoi_swar = time_scan(swar_eoi, frame, length, &eoi_swar);
+        double t_eoi_tracked = time_scan(tracked_eoi, frame, length, &eoi_tracked);
+
+        printf("%-18s %8zu %9.0f ns %9.0f ns %9.0f ns %9.0f ns %9.0f ns\n", pictures[p], length,
+               t_soi_legacy, t_soi_swar, t_eoi_legacy, t_eoi_swar, t_eoi_tracked);
+
+        if (soi_legacy != soi_swar || eoi_legacy != eoi_swar || eoi_legacy != eoi_tracked
+                || eoi_swar + 2 != (int)picture_length) {
+            fprintf(stderr, "%s: SOI %d/%d, EOI %d/%d/%d, picture ends at %zu\n", pictures[p],
+                    soi_legacy, soi_swar, eoi_legacy, eoi_swar, eoi_tracked, picture_length);
+            ok = false;
+        }
+        free(frame);
+    }
+
+    return ok ? 0 : 1;
+}
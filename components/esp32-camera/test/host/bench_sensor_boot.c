@@ -0,0 +1,37 @@
+// SCCB traffic and time esp_camera_init spends configuring a sensor, measured on the mock bus.
+//
+// Built once per driver, SENSOR names it:  -DSENSOR=ov5640
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mock_sccb.h"
+#include "sensor.h"
+
+#define CONCAT(a, b) a##b
+#define INIT(sensor) CONCAT(sensor, _init)
+#define STR(x) #x
+#define NAME(sensor) STR(sensor)
+
+int INIT(SENSOR)(sensor_t *sensor);
+
+int main(void)
+{
+    sensor_t sensor;
+    memset(&sensor, 0, sizeof(sensor));
+    sensor.xclk_freq_hz = 20000000;
+
+    mock_sccb_reset();
+    INIT(SENSOR)(&sensor);
+    sensor.reset(&sensor);
+    sensor.set_pixformat(&sensor, PIXFORMAT_JPEG);
+    sensor.set_framesize(&sensor, FRAMESIZE_VGA);
+    sensor.init_status(&sensor);
+
+    mock_sccb_stats_t wire = mock_sccb_stats;
+    wire.delay_ms = 0;
+    printf("%-8s %4u transactions %4u reads %4u writes, %4u ms of delays, bus %6.1f ms at 100 kHz %6.1f ms at 400 kHz\n",
+           NAME(SENSOR), mock_sccb_stats.transactions, mock_sccb_stats.reads, mock_sccb_stats.writes, mock_sccb_stats.delay_ms,
+           mock_sccb_time_us(&wire, 100000) / 1000.0, mock_sccb_time_us(&wire, 400000) / 1000.0);
+    return 0;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdio.h>
+
+/**
+ * @brief Failed CHECKs of the test, each test program includes this header once
+ */
+static int failures;
+
+/**
+ * @brief Report a failure with a printf style message when cond is false, and keep going
+ */
+#define CHECK(cond, ...) do { if (!(cond)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); failures++; } } while (0)
+
+/**
+ * @brief Print the verdict, the result is the exit status of the test
+ */
+static inline int check_report(void)
+{
+    printf("%s\n", failures ? "FAILED" : "OK");
+    return failures != 0;
+}
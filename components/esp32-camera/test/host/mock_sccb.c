@@ -0,0 +1,119 @@
+#include <string.h>
+
+#include "mock_sccb.h"
+#include "sccb.h"
+#include "xclk.h"
+
+//an address or data byte plus its acknowledge
+#define BYTE_BITS 9
+//start and stop conditions
+#define FRAME_BITS 2
+
+mock_sccb_stats_t mock_sccb_stats;
+uint8_t mock_sccb_regs[0x10000];
+
+static uint8_t bank;
+
+void mock_sccb_reset(void)
+{
+    uint32_t x = 1;
+    for (size_t i = 0; i < sizeof(mock_sccb_regs); i++) {
+        x = x * 1103515245 + 12345;
+        mock_sccb_regs[i] = x >> 16;
+    }
+    bank = 0;
+    memset(&mock_sccb_stats, 0, sizeof(mock_sccb_stats));
+}
+
+void mock_delay(uint32_t ms)
+{
+    mock_sccb_stats.delay_ms += ms;
+}
+
+uint32_t mock_sccb_time_us(const mock_sccb_stats_t *stats, uint32_t clk_hz)
+{
+    return (uint64_t)stats->bits * 1000000 / clk_hz + stats->delay_ms * 1000;
+}
+
+//a read is a write of the register address followed by a separate read transaction
+static void count_read(int address_bytes)
+{
+    mock_sccb_stats.reads++;
+    mock_sccb_stats.transactions += 2;
+    mock_sccb_stats.bits += (1 + address_bytes) * BYTE_BITS + FRAME_BITS + 2 * BYTE_BITS + FRAME_BITS;
+}
+
+static void count_write(int address_bytes, int data_bytes)
+{
+    mock_sccb_stats.writes += data_bytes;
+    mock_sccb_stats.bits += (1 + address_bytes + data_bytes) * BYTE_BITS + FRAME_BITS;
+}
+
+static void write_reg8(uint8_t reg, uint8_t data)
+{
+    if (reg == 0xFF) {
+        bank = data;
+    }
+    mock_sccb_regs[bank << 8 | reg] = data;
+}
+
+uint8_t SCCB_Read(uint8_t slv_addr, uint8_t reg)
+{
+    count_read(1);
+    return mock_sccb_regs[bank << 8 | reg];
+}
+
+uint8_t SCCB_Write(uint8_t slv_addr, uint8_t reg, uint8_t data)
+{
+    mock_sccb_stats.transactions++;
+    count_write(1, 1);
+    write_reg8(reg, data);
+    return 0;
+}
+
+uint8_t SCCB_Read16(uint8_t slv_addr, uint16_t reg)
+{
+    count_read(2);
+    return mock_sccb_regs[reg];
+}
+
+uint8_t SCCB_Write16(uint8_t slv_addr, uint16_t reg, uint8_t data)
+{
+    mock_sccb_stats.transactions++;
+    count_write(2, 1);
+    mock_sccb_regs[reg] = data;
+    return 0;
+}
+
+uint8_t SCCB_WriteBatch(uint8_t slv_addr, const uint16_t (*regs)[2], size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        mock_sccb_stats.transactions++;
+        count_write(1, 1);
+        write_reg8(regs[i][0], regs[i][1]);
+    }
+    return 0;
+}
+
+uint8_t SCCB_WriteBatch16(uint8_t slv_addr, const uint16_t (*regs)[2], size_t count, bool auto_increment)
+{
+    for (size_t i = 0; i < count; ) {
+        //the sensor increments the address after every data byte
+        size_t run = 1;
+        while (auto_increment && i + run < count && regs[i + run][0] == regs[i][0] + run) {
+            run++;
+        }
+        mock_sccb_stats.transactions++;
+        count_write(2, run);
+        for (size_t j = 0; j < run; j++) {
+            mock_sccb_regs[(uint16_t)(regs[i][0] + j)] = regs[i + j][1];
+        }
+        i += run;
+    }
+    return 0;
+}
+
+esp_err_t xclk_timer_conf(int ledc_timer, int xclk_freq_hz)
+{
+    return ESP_OK;
+}
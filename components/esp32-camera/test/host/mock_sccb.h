@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief Traffic seen by the mock bus since the last mock_sccb_reset()
+ */
+typedef struct {
+    uint32_t reads;         //registers read
+    uint32_t writes;        //registers written
+    uint32_t transactions;  //command lists the I2C driver had to run
+    uint32_t bits;      //clocked on the bus, start and stop conditions included
+    uint32_t delay_ms;  //spent in vTaskDelay
+} mock_sccb_stats_t;
+
+extern mock_sccb_stats_t mock_sccb_stats;
+
+/**
+ * @brief Register file of the mocked sensor
+ *
+ * 16 bit register addresses index it directly. 8 bit ones are offset by the bank last written to
+ * register 0xFF times 256, which is how the OmniVision sensors with 8 bit addresses select banks.
+ */
+extern uint8_t mock_sccb_regs[0x10000];
+
+/**
+ * @brief Fill the register file with the same pseudo random power-on values and clear the counters
+ */
+void mock_sccb_reset(void);
+
+/**
+ * @brief Time the traffic and delays in stats would have taken at clk_hz
+ */
+uint32_t mock_sccb_time_us(const mock_sccb_stats_t *stats, uint32_t clk_hz);
@@ -0,0 +1,4 @@
+#pragma once
+
+#define DRAM_ATTR
+#define IRAM_ATTR
@@ -0,0 +1,13 @@
+#pragma once
+
+static inline void mock_log(const char *tag, const char *format, ...)
+{
+    (void)tag;
+    (void)format;
+}
+
+#define ESP_LOGE(tag, ...) mock_log(tag, __VA_ARGS__)
+#define ESP_LOGW(tag, ...) mock_log(tag, __VA_ARGS__)
+#define ESP_LOGI(tag, ...) mock_log(tag, __VA_ARGS__)
+#define ESP_LOGD(tag, ...) mock_log(tag, __VA_ARGS__)
+#define ESP_LOGV(tag, ...) mock_log(tag, __VA_ARGS__)
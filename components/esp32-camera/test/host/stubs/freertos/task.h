@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+#define portTICK_PERIOD_MS 1
+
+//delays only add to the simulated time, see mock_sccb.h
+void mock_delay(uint32_t ms);
+
+static inline void vTaskDelay(uint32_t ticks)
+{
+    mock_delay(ticks * portTICK_PERIOD_MS);
+}
@@ -0,0 +1,138 @@
+// Randomized check of the frame pool arena: every live block keeps its contents while others are
+// reserved, committed and released out of order around it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cam_arena.h"
+#include "check.h"
+
+#define ARENA_SIZE   (64 * 1024)
+#define MAX_RESERVE  (12 * 1024)
+#define SLOTS        12
+#define ITERATIONS   200000
+
+typedef struct {
+    int block;
+    size_t len;
+    uint8_t fill;
+    int refs;
+} slot_t;
+
+static void check_slot(cam_arena_t *arena, const slot_t *slot)
+{
+    const uint8_t *data = cam_arena_data(arena, slot->block);
+    for (size_t i = 0; i < slot->len; i++) {
+        if (data[i] != (uint8_t)(slot->fill + i)) {
+            CHECK(0, "block %d byte %zu overwritten", slot->block, i);
+            return;
+        }
+    }
+}
+
+static void test_wraparound(void)
+{
+    static uint8_t buf[100];
+    cam_arena_block_t blocks[4];
+    cam_arena_t arena;
+    cam_arena_init(&arena, buf, sizeof(buf), blocks, 4);
+
+    int a = cam_arena_reserve(&arena, 40);
+    cam_arena_commit(&arena, a, 30);
+    int b = cam_arena_reserve(&arena, 60);
+    cam_arena_commit(&arena, b, 50);
+    CHECK(cam_arena_data(&arena, b) == buf + 30, "committed length not reclaimed");
+
+    //20 bytes are left before the end and the start is still held by a
+    CHECK(cam_arena_reserve(&arena, 21) < 0, "reserved over a live block");
+
+    cam_arena_release(&arena, a);
+    int c = cam_arena_reserve(&arena, 25);
+    CHECK(c >= 0 && cam_arena_data(&arena, c) == buf, "did not wrap to the start");
+    CHECK(cam_arena_used(&arena) == 95, "used %zu", cam_arena_used(&arena));
+    if (c < 0) {
+        return;
+    }
+
+    //the skipped tail comes back once b is gone
+    cam_arena_commit(&arena, c, 10);
+    cam_arena_release(&arena, b);
+    CHECK(cam_arena_used(&arena) == 10, "used %zu", cam_arena_used(&arena));
+    int d = cam_arena_reserve(&arena, 90);
+    CHECK(d >= 0 && cam_arena_data(&arena, d) == buf + 10, "tail not reclaimed");
+}
+
+static void test_out_of_order_release(void)
+{
+    static uint8_t buf[100];
+    cam_arena_block_t blocks[4];
+    cam_arena_t arena;
+    cam_arena_init(&arena, buf, sizeof(buf), blocks, 4);
+
+    int a = cam_arena_reserve(&arena, 50);
+    int b = cam_arena_reserve(&arena, 50);
+    cam_arena_retain(&arena, b);
+    CHECK(!cam_arena_release(&arena, b), "released a retained block");
+    CHECK(cam_arena_release(&arena, b), "last reference not reported");
+
+    //b is free but a still pins the ring, so nothing is reclaimed yet
+    CHECK(cam_arena_reserve(&arena, 1) < 0, "space behind a live block reused");
+    cam_arena_release(&arena, a);
+    CHECK(cam_arena_used(&arena) == 0, "used %zu", cam_arena_used(&arena));
+}
+
+static void test_random(void)
+{
+    static uint8_t buf[ARENA_SIZE];
+    cam_arena_block_t blocks[SLOTS * 2];
+    cam_arena_t arena;
+    cam_arena_init(&arena, buf, sizeof(buf), blocks, SLOTS * 2);
+
+    slot_t slots[SLOTS];
+    for (int i = 0; i < SLOTS; i++) {
+        slots[i].refs = 0;
+    }
+
+    size_t committed = 0, frames = 0;
+    for (int n = 0; n < ITERATIONS && !failures; n++) {
+        int s = rand() % SLOTS;
+        slot_t *slot = &slots[s];
+        if (slot->refs == 0) {
+            int block = cam_arena_reserve(&arena, MAX_RESERVE);
+            if (block < 0) {
+                continue;
+            }
+            slot->block = block;
+            slot->len = 1 + rand() % MAX_RESERVE / (1 + rand() % 4);
+            slot->fill = rand();
+            slot->refs = 1 + (rand() % 4 == 0);
+            uint8_t *data = cam_arena_data(&arena, block);
+            for (size_t i = 0; i < slot->len; i++) {
+                data[i] = slot->fill + i;
+            }
+            cam_arena_commit(&arena, block, slot->len);
+            if (slot->refs > 1) {
+                cam_arena_retain(&arena, block);
+            }
+            committed += slot->len;
+            frames++;
+        } else {
+            check_slot(&arena, slot);
+            bool last = cam_arena_release(&arena, slot->block);
+            CHECK(last == (--slot->refs == 0), "release of block %d reported %d", slot->block, last);
+        }
+        CHECK(cam_arena_used(&arena) <= ARENA_SIZE, "used %zu", cam_arena_used(&arena));
+    }
+
+    printf("random: %zu frames, %zu bytes average\n", frames, frames ? committed / frames : 0);
+}
+
+int main(void)
+{
+    srand(1);
+    test_wraparound();
+    test_out_of_order_release();
+    test_random();
+    return check_report();
+}
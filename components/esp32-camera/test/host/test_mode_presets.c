@@ -0,0 +1,78 @@
+// Switches frame sizes with and without mode presets on the mock bus and checks that both leave the
+// sensor with the same registers, while counting what each switch costs.
+//
+// Built once per driver, SENSOR names it:  -DSENSOR=ov2640
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mock_sccb.h"
+#include "check.h"
+#include "sensor.h"
+
+#define CONCAT(a, b) a##b
+#define INIT(sensor) CONCAT(sensor, _init)
+#define STR(x) #x
+#define NAME(sensor) STR(sensor)
+
+#define CLK_HZ      100000
+#define FRAME_US    (1000000 / 25)
+
+int INIT(SENSOR)(sensor_t *sensor);
+
+static const framesize_t preset_sizes[] = {
+    FRAMESIZE_QQVGA, FRAMESIZE_QVGA, FRAMESIZE_CIF, FRAMESIZE_HVGA, FRAMESIZE_VGA, FRAMESIZE_SVGA,
+};
+
+#define NUM_PRESETS (sizeof(preset_sizes) / sizeof(preset_sizes[0]))
+
+static uint8_t expected[sizeof(mock_sccb_regs)];
+
+//registers after switching from one frame size to another, and the traffic of the switch alone
+static mock_sccb_stats_t switch_framesize(framesize_t from, framesize_t to, bool use_presets)
+{
+    sensor_t sensor;
+    memset(&sensor, 0, sizeof(sensor));
+    sensor.xclk_freq_hz = 20000000;
+
+    mock_sccb_reset();
+    INIT(SENSOR)(&sensor);
+    sensor.reset(&sensor);
+    sensor.set_pixformat(&sensor, PIXFORMAT_JPEG);
+    sensor.set_mode_presets(&sensor, preset_sizes, use_presets ? NUM_PRESETS : 0);
+    sensor.set_framesize(&sensor, from);
+
+    memset(&mock_sccb_stats, 0, sizeof(mock_sccb_stats));
+    sensor.set_framesize(&sensor, to);
+    return mock_sccb_stats;
+}
+
+int main(void)
+{
+    printf("%s at %u Hz\n", NAME(SENSOR), CLK_HZ);
+    for (size_t i = 0; i < NUM_PRESETS; i++) {
+        for (size_t j = 0; j < NUM_PRESETS; j++) {
+            framesize_t from = preset_sizes[i], to = preset_sizes[j];
+            mock_sccb_stats_t full = switch_framesize(from, to, false);
+            memcpy(expected, mock_sccb_regs, sizeof(expected));
+            mock_sccb_stats_t preset = switch_framesize(from, to, true);
+
+            for (size_t reg = 0; reg < sizeof(expected); reg++) {
+                if (expected[reg] != mock_sccb_regs[reg]) {
+                    CHECK(0, "%dx%d -> %dx%d: register 0x%04zx is 0x%02x with presets, 0x%02x without",
+                          resolution[from].width, resolution[from].height, resolution[to].width, resolution[to].height,
+                          reg, mock_sccb_regs[reg], expected[reg]);
+                    break;
+                }
+            }
+
+            uint32_t full_us = mock_sccb_time_us(&full, CLK_HZ), preset_us = mock_sccb_time_us(&preset, CLK_HZ);
+            CHECK(preset_us <= full_us, "presets made a switch slower");
+            printf("%4dx%-4d -> %4dx%-4d  full: %3u writes %5.1f ms   preset: %3u writes %5.1f ms (%.1f frames at 25 fps)\n",
+                   resolution[from].width, resolution[from].height, resolution[to].width, resolution[to].height,
+                   full.writes, full_us / 1000.0, preset.writes, preset_us / 1000.0, (double)preset_us / FRAME_US);
+        }
+    }
+
+    return check_report();
+}
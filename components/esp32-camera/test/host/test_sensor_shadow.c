@@ -0,0 +1,131 @@
+// Runs a sensor driver against the mock bus twice, with and without its register shadow, and checks
+// that both leave the sensor in the same state while counting the SCCB traffic each one needs.
+//
+// Built once per driver, SENSOR names it:  -DSENSOR=ov5640 -DSENSOR_ov5640
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mock_sccb.h"
+#include "check.h"
+
+#define STR(x) #x
+#define SOURCE(sensor) STR(../../sensors/sensor.c)
+#define NAME(sensor) STR(sensor)
+#define CONCAT(a, b) a##b
+#define INIT(sensor) CONCAT(sensor, _init)
+
+#include SOURCE(SENSOR)
+
+#define CLK_HZ  100000
+#define ROUNDS  20
+
+typedef struct {
+    mock_sccb_stats_t boot;
+    mock_sccb_stats_t control;
+    uint32_t boot_us;
+    uint8_t regs[sizeof(mock_sccb_regs)];
+} run_t;
+
+//registers AEC, AGC and AWB update while the sensor runs, as mock_sccb_regs indexes
+#if defined(SENSOR_ov2640)
+static const uint16_t sensor_owned[] = {
+    0x100, 0x104, 0x110, 0x145,                 //GAIN, REG04, AEC and REG45 in the sensor bank
+};
+#elif defined(SENSOR_ov5640)
+static const uint16_t sensor_owned[] = {
+    0x3400, 0x3401, 0x3402, 0x3403, 0x3404, 0x3405,
+    0x3500, 0x3501, 0x3502, 0x350A, 0x350B,
+};
+#endif
+
+static void sensor_activity(int round)
+{
+    for (size_t i = 0; i < sizeof(sensor_owned) / sizeof(sensor_owned[0]); i++) {
+        mock_sccb_regs[sensor_owned[i]] ^= 0x11 * (round + 1);
+    }
+}
+
+static void run(run_t *result, bool use_shadow)
+{
+    sensor_t sensor;
+    memset(&sensor, 0, sizeof(sensor));
+    sensor.xclk_freq_hz = 20000000;
+
+    mock_sccb_reset();
+    INIT(SENSOR)(&sensor);
+    if (!use_shadow) {
+        sccb_shadow_deinit(&shadow);
+    }
+
+    //what esp_camera_init does
+    sensor.reset(&sensor);
+    sensor.set_pixformat(&sensor, PIXFORMAT_JPEG);
+    sensor.set_framesize(&sensor, FRAMESIZE_VGA);
+    sensor.init_status(&sensor);
+    result->boot = mock_sccb_stats;
+    result->boot_us = mock_sccb_time_us(&mock_sccb_stats, CLK_HZ);
+
+    //a client adjusting the picture, mostly resending what is already set
+    memset(&mock_sccb_stats, 0, sizeof(mock_sccb_stats));
+    for (int i = 0; i < ROUNDS; i++) {
+        sensor_activity(i);
+        sensor.set_quality(&sensor, 10 + i % 3);
+        sensor.set_brightness(&sensor, i % 3 - 1);
+        sensor.set_contrast(&sensor, 1);
+        sensor.set_saturation(&sensor, 0);
+        sensor.set_whitebal(&sensor, 1);
+        sensor.set_awb_gain(&sensor, 1);
+        sensor.set_wb_mode(&sensor, 0);
+        sensor.set_exposure_ctrl(&sensor, i % 5 != 0);
+        sensor.set_aec2(&sensor, 0);
+        sensor.set_ae_level(&sensor, 0);
+        sensor.set_aec_value(&sensor, 300 + i);
+        sensor.set_gain_ctrl(&sensor, 1);
+        sensor.set_agc_gain(&sensor, i % 30);
+        sensor.set_gainceiling(&sensor, GAINCEILING_4X);
+        sensor.set_bpc(&sensor, 0);
+        sensor.set_wpc(&sensor, 1);
+        sensor.set_raw_gma(&sensor, 1);
+        sensor.set_lenc(&sensor, 1);
+        sensor.set_hmirror(&sensor, i & 1);
+        sensor.set_vflip(&sensor, 0);
+        sensor.set_dcw(&sensor, 1);
+        sensor.set_colorbar(&sensor, 0);
+        sensor.set_special_effect(&sensor, 0);
+    }
+    result->control = mock_sccb_stats;
+    memcpy(result->regs, mock_sccb_regs, sizeof(result->regs));
+    sccb_shadow_deinit(&shadow);
+}
+
+static void report(const char *name, const run_t *result)
+{
+    printf("%-10s boot: %5u reads %5u writes %7.1f ms   controls: %5u reads %5u writes %7.1f ms\n", name,
+           result->boot.reads, result->boot.writes, result->boot_us / 1000.0,
+           result->control.reads, result->control.writes, mock_sccb_time_us(&result->control, CLK_HZ) / 1000.0);
+}
+
+int main(void)
+{
+    static run_t plain, shadowed;
+    run(&plain, false);
+    run(&shadowed, true);
+
+    printf("%s at %u Hz\n", NAME(SENSOR), CLK_HZ);
+    report("no shadow", &plain);
+    report("shadow", &shadowed);
+
+    for (size_t reg = 0; reg < sizeof(plain.regs); reg++) {
+        if (plain.regs[reg] != shadowed.regs[reg]) {
+            CHECK(0, "register 0x%04zx is 0x%02x with the shadow, 0x%02x without", reg, shadowed.regs[reg], plain.regs[reg]);
+            break;
+        }
+    }
+    CHECK(shadowed.control.reads < plain.control.reads, "shadow did not save any reads");
+    CHECK(shadowed.control.writes < plain.control.writes, "shadow did not save any writes");
+    CHECK(shadowed.boot.reads + shadowed.boot.writes <= plain.boot.reads + plain.boot.writes, "shadow made boot slower");
+
+    return check_report();
+}
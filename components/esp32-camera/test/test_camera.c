@@ -338,6 +338,32 @@ TEST_CASE("Camera driver take JPEG picture test", "[camera]")
     TEST_ASSERT_NOT_NULL(pic);
 }
 
+TEST_CASE("Camera driver stats test", "[camera]")
+{
+    camera_stats_t stats;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, esp_camera_get_stats(&stats));
+
+    TEST_ESP_OK(init_camera(20000000, PIXFORMAT_JPEG, FRAMESIZE_QVGA, 2, SIOD_GPIO_NUM, -1));
+    vTaskDelay(500 / portTICK_RATE_MS);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, esp_camera_get_stats(NULL));
+
+    for (int i = 0; i < 16; i++) {
+        camera_fb_t *pic = esp_camera_fb_get();
+        TEST_ASSERT_NOT_NULL(pic);
+        // Every frame handed out is trimmed to a complete JPEG
+        TEST_ASSERT_EQUAL_HEX8(0xFF, pic->buf[pic->len - 2]);
+        TEST_ASSERT_EQUAL_HEX8(0xD9, pic->buf[pic->len - 1]);
+        esp_camera_fb_return(pic);
+    }
+
+    TEST_ESP_OK(esp_camera_get_stats(&stats));
+    ESP_LOGI(TAG, "NO-SOI %u, NO-EOI %u, FB-OVF %u, FBQ-RCV %u, FBQ-SND %u, retries exhausted %u",
+             stats.no_soi, stats.no_eoi, stats.fb_overflow, stats.fbq_receive, stats.fbq_send, stats.retries_exhausted);
+    TEST_ASSERT_EQUAL(0, stats.retries_exhausted);
+
+    TEST_ESP_OK(esp_camera_deinit());
+}
+
 TEST_CASE("Camera driver performance test", "[camera]")
 {
     camera_performance_test(20 * 1000000, 16);
@@ -0,0 +1,190 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "espnow_stream.h"
+
+#define MAX_FRAGMENTS UINT16_MAX
+
+static void put_u16(uint8_t *at, uint16_t value)
+{
+    at[0] = value >> 8;
+    at[1] = value;
+}
+
+static void put_u32(uint8_t *at, uint32_t value)
+{
+    at[0] = value >> 24;
+    at[1] = value >> 16;
+    at[2] = value >> 8;
+    at[3] = value;
+}
+
+static uint16_t get_u16(const uint8_t *at)
+{
+    return (uint16_t)at[0] << 8 | at[1];
+}
+
+static uint32_t get_u32(const uint8_t *at)
+{
+    return (uint32_t)at[0] << 24 | (uint32_t)at[1] << 16 | (uint32_t)at[2] << 8 | at[3];
+}
+
+static size_t fragment_count(size_t frame_length)
+{
+    return (frame_length + ESPNOW_STREAM_PAYLOAD_SIZE - 1) / ESPNOW_STREAM_PAYLOAD_SIZE;
+}
+
+// Frame ids wrap around, anything up to half the id space ahead counts as newer
+static bool is_newer(uint16_t frame_id, uint16_t than)
+{
+    return (int16_t)(frame_id - than) > 0;
+}
+
+void espnow_stream_tx_init(espnow_stream_tx_t *tx, espnow_stream_send_t send, void *ctx)
+{
+    tx->send = send;
+    tx->ctx = ctx;
+    tx->next_frame_id = 0;
+}
+
+esp_err_t espnow_stream_send_frame(espnow_stream_tx_t *tx, const uint8_t *frame, size_t len)
+{
+    size_t count = fragment_count(len);
+    if (count == 0 || count > MAX_FRAGMENTS) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint16_t frame_id = tx->next_frame_id++;
+    uint8_t packet[ESPNOW_STREAM_PACKET_SIZE];
+    packet[0] = ESPNOW_STREAM_MAGIC;
+    packet[1] = ESPNOW_STREAM_VERSION;
+    put_u16(&packet[2], frame_id);
+    put_u16(&packet[6], count);
+    put_u32(&packet[8], len);
+
+    for (size_t i = 0; i < count; ++i) {
+        size_t offset = i * ESPNOW_STREAM_PAYLOAD_SIZE;
+        size_t payload = len - offset < ESPNOW_STREAM_PAYLOAD_SIZE ? len - offset : ESPNOW_STREAM_PAYLOAD_SIZE;
+        put_u16(&packet[4], i);
+        memcpy(&packet[ESPNOW_STREAM_HEADER_SIZE], &frame[offset], payload);
+
+        esp_err_t err = tx->send(tx->ctx, packet, ESPNOW_STREAM_HEADER_SIZE + payload);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t espnow_stream_rx_init(espnow_stream_rx_t *rx, size_t max_frame_size, espnow_stream_frame_cb_t on_frame, void *ctx)
+{
+    memset(rx, 0, sizeof(*rx));
+
+    size_t max_fragments = fragment_count(max_frame_size);
+    if (max_fragments == 0 || max_fragments > MAX_FRAGMENTS) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    rx->buffer = malloc(max_frame_size);
+    rx->received = calloc((max_fragments + 31) / 32, sizeof(uint32_t));
+    if (!rx->buffer || !rx->received) {
+        espnow_stream_rx_deinit(rx);
+        return ESP_ERR_NO_MEM;
+    }
+
+    rx->capacity = max_frame_size;
+    rx->max_fragments = max_fragments;
+    rx->on_frame = on_frame;
+    rx->ctx = ctx;
+    return ESP_OK;
+}
+
+void espnow_stream_rx_deinit(espnow_stream_rx_t *rx)
+{
+    free(rx->buffer);
+    free(rx->received);
+    rx->buffer = NULL;
+    rx->received = NULL;
+}
+
+static void finish_frame(espnow_stream_rx_t *rx)
+{
+    rx->in_progress = false;
+    rx->has_finished_frame = true;
+    rx->finished_frame_id = rx->frame_id;
+}
+
+static void start_frame(espnow_stream_rx_t *rx, uint16_t frame_id, uint16_t count, uint32_t frame_length)
+{
+    rx->in_progress = true;
+    rx->frame_id = frame_id;
+    rx->fragment_count = count;
+    rx->fragments_received = 0;
+    rx->frame_length = frame_length;
+    memset(rx->received, 0, (count + 31) / 32 * sizeof(uint32_t));
+}
+
+esp_err_t espnow_stream_rx_feed(espnow_stream_rx_t *rx, const uint8_t *packet, size_t len)
+{
+    if (len <= ESPNOW_STREAM_HEADER_SIZE || len > ESPNOW_STREAM_PACKET_SIZE
+            || packet[0] != ESPNOW_STREAM_MAGIC || packet[1] != ESPNOW_STREAM_VERSION) {
+        rx->stats.fragments_invalid++;
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint16_t frame_id = get_u16(&packet[2]);
+    uint16_t index = get_u16(&packet[4]);
+    uint16_t count = get_u16(&packet[6]);
+    uint32_t frame_length = get_u32(&packet[8]);
+
+    size_t offset = (size_t)index * ESPNOW_STREAM_PAYLOAD_SIZE;
+    size_t payload = len - ESPNOW_STREAM_HEADER_SIZE;
+    bool is_last = index + 1 == count;
+    if (index >= count || count != fragment_count(frame_length)
+            || payload != (is_last ? frame_length - offset : ESPNOW_STREAM_PAYLOAD_SIZE)) {
+        rx->stats.fragments_invalid++;
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (rx->in_progress && frame_id == rx->frame_id) {
+        if (count != rx->fragment_count || frame_length != rx->frame_length) {
+            rx->stats.fragments_invalid++;
+            return ESP_ERR_INVALID_ARG;
+        }
+    } else {
+        uint16_t latest = rx->in_progress ? rx->frame_id : rx->finished_frame_id;
+        if ((rx->in_progress || rx->has_finished_frame) && !is_newer(frame_id, latest)) {
+            rx->stats.fragments_ignored++;
+            return ESP_OK;
+        }
+
+        if (frame_length > rx->capacity) {
+            rx->stats.fragments_invalid++;
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        if (rx->in_progress) {
+            rx->stats.frames_dropped++;
+        }
+        start_frame(rx, frame_id, count, frame_length);
+    }
+
+    uint32_t bit = 1u << (index % 32);
+    if (rx->received[index / 32] & bit) {
+        rx->stats.fragments_ignored++;
+        return ESP_OK;
+    }
+    rx->received[index / 32] |= bit;
+    memcpy(&rx->buffer[offset], &packet[ESPNOW_STREAM_HEADER_SIZE], payload);
+
+    if (++rx->fragments_received == rx->fragment_count) {
+        finish_frame(rx);
+        rx->stats.frames_completed++;
+        if (rx->on_frame) {
+            rx->on_frame(rx->ctx, rx->frame_id, rx->buffer, rx->frame_length);
+        }
+    }
+
+    return ESP_OK;
+}
@@ -0,0 +1,58 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_now.h"
+
+#include "espnow_stream.h"
+
+#define SEND_RETRIES 20
+
+_Static_assert(ESPNOW_STREAM_PACKET_SIZE == ESP_NOW_MAX_DATA_LEN, "Fragments must fill an ESP-NOW packet");
+
+static volatile uint32_t packets_sent;
+static volatile uint32_t packets_confirmed;
+static espnow_stream_rx_t *s_rx;
+
+static void send_cb(const uint8_t *mac_addr, esp_now_send_status_t status)
+{
+    packets_confirmed++;
+}
+
+static void recv_cb(const uint8_t *mac_addr, const uint8_t *data, int data_len)
+{
+    espnow_stream_rx_feed(s_rx, data, data_len);
+}
+
+esp_err_t espnow_stream_esp_send(void *peer_mac, const uint8_t *packet, size_t len)
+{
+    // The Wi-Fi task drains the queue at the link rate, a full queue clears within a few ticks
+    // Counted up front, the send callback can fire before esp_now_send returns
+    packets_sent++;
+    esp_err_t err = ESP_ERR_ESPNOW_NO_MEM;
+    for (int i = 0; i < SEND_RETRIES && err == ESP_ERR_ESPNOW_NO_MEM; ++i) {
+        if (i > 0) {
+            vTaskDelay(1);
+        }
+        err = esp_now_send(peer_mac, packet, len);
+    }
+
+    if (err != ESP_OK) {
+        packets_sent--;
+    }
+    return err;
+}
+
+uint32_t espnow_stream_esp_in_flight(void)
+{
+    return packets_sent - packets_confirmed;
+}
+
+esp_err_t espnow_stream_esp_start_tx(void)
+{
+    return esp_now_register_send_cb(send_cb);
+}
+
+esp_err_t espnow_stream_esp_start_rx(espnow_stream_rx_t *rx)
+{
+    s_rx = rx;
+    return esp_now_register_recv_cb(recv_cb);
+}
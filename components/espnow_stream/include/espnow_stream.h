@@ -0,0 +1,157 @@
+/*
+ * Frame transport over ESP-NOW.
+ *
+ * ESP-NOW carries at most 250 bytes per packet, so frames are split into fragments that each start
+ * with a small header (all fields in network byte order):
+ *
+ *   0  magic           0xE5
+ *   1  version         1
+ *   2  frame id        incremented per frame, wraps around
+ *   4  fragment index  0 .. fragment count - 1
+ *   6  fragment count  ceil(frame length / ESPNOW_STREAM_PAYLOAD_SIZE)
+ *   8  frame length    total frame size in bytes
+ *
+ * Fragment i carries bytes [i * ESPNOW_STREAM_PAYLOAD_SIZE, (i + 1) * ESPNOW_STREAM_PAYLOAD_SIZE) of the frame.
+ *
+ * The fragmenting and reassembly code does not touch ESP-NOW itself; packets go out through a send
+ * callback and come in through espnow_stream_rx_feed(). espnow_stream_esp_* binds both ends to esp_now.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ESPNOW_STREAM_PACKET_SIZE 250   /*!< ESP_NOW_MAX_DATA_LEN */
+#define ESPNOW_STREAM_HEADER_SIZE 12
+#define ESPNOW_STREAM_PAYLOAD_SIZE (ESPNOW_STREAM_PACKET_SIZE - ESPNOW_STREAM_HEADER_SIZE)
+
+#define ESPNOW_STREAM_MAGIC 0xE5
+#define ESPNOW_STREAM_VERSION 1
+
+/**
+ * @brief Hands one packet to the link layer
+ *
+ * @param ctx     Context given to espnow_stream_tx_init
+ * @param packet  Packet to send, only valid for the duration of the call
+ * @param len     Packet length, at most ESPNOW_STREAM_PACKET_SIZE
+ *
+ * @return ESP_OK if the packet was queued
+ */
+typedef esp_err_t (*espnow_stream_send_t)(void *ctx, const uint8_t *packet, size_t len);
+
+/**
+ * @brief Called with every completely reassembled frame
+ *
+ * The frame buffer belongs to the receiver and is overwritten by the next frame.
+ */
+typedef void (*espnow_stream_frame_cb_t)(void *ctx, uint16_t frame_id, const uint8_t *frame, size_t len);
+
+typedef struct {
+    espnow_stream_send_t send;
+    void *ctx;
+    uint16_t next_frame_id;
+} espnow_stream_tx_t;
+
+typedef struct {
+    uint32_t frames_completed;
+    uint32_t frames_dropped;      /*!< Abandoned incomplete because a newer frame started */
+    uint32_t fragments_ignored;   /*!< Duplicates and fragments of frames already finished */
+    uint32_t fragments_invalid;
+} espnow_stream_rx_stats_t;
+
+typedef struct {
+    uint8_t *buffer;
+    size_t capacity;
+    uint32_t *received;           /*!< One bit per fragment of the frame in progress */
+    uint16_t max_fragments;
+
+    bool in_progress;
+    uint16_t frame_id;
+    uint16_t fragment_count;
+    uint16_t fragments_received;
+    uint32_t frame_length;
+
+    bool has_finished_frame;
+    uint16_t finished_frame_id;   /*!< Last frame completed or dropped, older fragments are stale */
+
+    espnow_stream_frame_cb_t on_frame;
+    void *ctx;
+    espnow_stream_rx_stats_t stats;
+} espnow_stream_rx_t;
+
+/**
+ * @brief Initialize a sender
+ */
+void espnow_stream_tx_init(espnow_stream_tx_t *tx, espnow_stream_send_t send, void *ctx);
+
+/**
+ * @brief Split a frame into fragments and send them in order
+ *
+ * @return
+ *     - ESP_OK if all fragments were sent
+ *     - ESP_ERR_INVALID_SIZE if the frame is empty or needs more than 65535 fragments
+ *     - The send callback's error for the first fragment it refused; the rest of the frame is not sent
+ */
+esp_err_t espnow_stream_send_frame(espnow_stream_tx_t *tx, const uint8_t *frame, size_t len);
+
+/**
+ * @brief Initialize a receiver for frames of up to max_frame_size bytes
+ *
+ * @return ESP_OK, or ESP_ERR_NO_MEM if the reassembly buffer can't be allocated
+ */
+esp_err_t espnow_stream_rx_init(espnow_stream_rx_t *rx, size_t max_frame_size, espnow_stream_frame_cb_t on_frame, void *ctx);
+
+void espnow_stream_rx_deinit(espnow_stream_rx_t *rx);
+
+/**
+ * @brief Feed one received packet to the receiver
+ *
+ * Fragments may arrive in any order. A fragment of a newer frame abandons the frame in progress,
+ * fragments of older frames are ignored. on_frame is called from within this function.
+ *
+ * @return
+ *     - ESP_OK if the packet was accepted or ignored as stale or duplicate
+ *     - ESP_ERR_INVALID_ARG if the packet is not a valid fragment
+ *     - ESP_ERR_INVALID_SIZE if the frame does not fit the reassembly buffer
+ */
+esp_err_t espnow_stream_rx_feed(espnow_stream_rx_t *rx, const uint8_t *packet, size_t len);
+
+/**
+ * @brief Send fragments to an ESP-NOW peer
+ *
+ * esp_now_init() has to be called and the peer added beforehand. Use as the send callback with the
+ * peer's MAC address as context. Waits briefly when the ESP-NOW queue is full.
+ */
+esp_err_t espnow_stream_esp_send(void *peer_mac, const uint8_t *packet, size_t len);
+
+/**
+ * @brief Number of packets handed to ESP-NOW that have not been confirmed yet
+ *
+ * Senders can skip whole frames while the link is backed up instead of losing fragments.
+ */
+uint32_t espnow_stream_esp_in_flight(void);
+
+/**
+ * @brief Register the send status callback used by espnow_stream_esp_in_flight()
+ */
+esp_err_t espnow_stream_esp_start_tx(void);
+
+/**
+ * @brief Feed every received ESP-NOW packet to a receiver
+ *
+ * esp_now_init() has to be called beforehand. on_frame then runs in the Wi-Fi task, so it should
+ * only copy the frame out or hand it over to another task.
+ */
+esp_err_t espnow_stream_esp_start_rx(espnow_stream_rx_t *rx);
+
+#ifdef __cplusplus
+}
+#endif
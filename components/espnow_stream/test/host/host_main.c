@@ -0,0 +1,28 @@
+#include "unity.h"
+#include "host_test_case.h"
+
+static host_test_case_t *s_tests;
+static host_test_case_t **s_tail = &s_tests;
+
+void host_test_register(host_test_case_t *test)
+{
+    *s_tail = test;
+    s_tail = &test->next;
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    for (host_test_case_t *test = s_tests; test; test = test->next) {
+        UnityDefaultTestRun(test->fn, test->name, test->line);
+    }
+    return UNITY_END();
+}
@@ -0,0 +1,23 @@
+// Registers IDF-style TEST_CASEs in a list so the on-target test files build unchanged on the host
+#pragma once
+
+typedef struct host_test_case {
+    const char *name;
+    void (*fn)(void);
+    int line;
+    struct host_test_case *next;
+} host_test_case_t;
+
+void host_test_register(host_test_case_t *test);
+
+#define HOST_CONCAT_(a, b) a##b
+#define HOST_CONCAT(a, b) HOST_CONCAT_(a, b)
+
+#define TEST_CASE(name_, tags_) \
+    static void HOST_CONCAT(test_fn_, __LINE__)(void); \
+    static host_test_case_t HOST_CONCAT(test_case_, __LINE__) = { name_, HOST_CONCAT(test_fn_, __LINE__), __LINE__, 0 }; \
+    __attribute__((constructor)) static void HOST_CONCAT(test_register_, __LINE__)(void) \
+    { \
+        host_test_register(&HOST_CONCAT(test_case_, __LINE__)); \
+    } \
+    static void HOST_CONCAT(test_fn_, __LINE__)(void)
@@ -0,0 +1,223 @@
+#include <stdlib.h>
+#include <string.h>
+#include "unity.h"
+
+#include "espnow_stream.h"
+
+// Stands in for ESP-NOW: sent packets are kept in order and can be dropped, duplicated or reordered
+// before they are fed to the receiver
+#define FAKE_MAX_PACKETS 256
+
+typedef struct {
+    uint8_t packets[FAKE_MAX_PACKETS][ESPNOW_STREAM_PACKET_SIZE];
+    size_t lens[FAKE_MAX_PACKETS];
+    int count;
+    int fail_at;    // index of the packet the link refuses, -1 for none
+} fake_espnow_t;
+
+typedef struct {
+    uint8_t frame[FAKE_MAX_PACKETS * ESPNOW_STREAM_PAYLOAD_SIZE];
+    size_t len;
+    uint16_t frame_id;
+    int frames;
+} received_t;
+
+static fake_espnow_t s_link;
+static received_t s_received;
+
+static esp_err_t fake_send(void *ctx, const uint8_t *packet, size_t len)
+{
+    fake_espnow_t *link = ctx;
+    if (len > ESPNOW_STREAM_PACKET_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (link->count == link->fail_at || link->count == FAKE_MAX_PACKETS) {
+        return ESP_FAIL;
+    }
+    memcpy(link->packets[link->count], packet, len);
+    link->lens[link->count++] = len;
+    return ESP_OK;
+}
+
+static void on_frame(void *ctx, uint16_t frame_id, const uint8_t *frame, size_t len)
+{
+    received_t *received = ctx;
+    memcpy(received->frame, frame, len);
+    received->len = len;
+    received->frame_id = frame_id;
+    received->frames++;
+}
+
+static void setup(espnow_stream_tx_t *tx, espnow_stream_rx_t *rx, size_t max_frame_size)
+{
+    memset(&s_link, 0, sizeof(s_link));
+    memset(&s_received, 0, sizeof(s_received));
+    s_link.fail_at = -1;
+    espnow_stream_tx_init(tx, fake_send, &s_link);
+    TEST_ASSERT_EQUAL(ESP_OK, espnow_stream_rx_init(rx, max_frame_size, on_frame, &s_received));
+}
+
+static void fill_frame(uint8_t *frame, size_t len, unsigned seed)
+{
+    srand(seed);
+    for (size_t i = 0; i < len; ++i) {
+        frame[i] = rand();
+    }
+}
+
+static void deliver(espnow_stream_rx_t *rx, int index)
+{
+    espnow_stream_rx_feed(rx, s_link.packets[index], s_link.lens[index]);
+}
+
+TEST_CASE("ESP-NOW stream loopback of frames around fragment boundaries", "[espnow_stream]")
+{
+    static uint8_t frame[20000];
+    const size_t sizes[] = { 1, ESPNOW_STREAM_PAYLOAD_SIZE - 1, ESPNOW_STREAM_PAYLOAD_SIZE,
+                             ESPNOW_STREAM_PAYLOAD_SIZE + 1, 3 * ESPNOW_STREAM_PAYLOAD_SIZE, sizeof(frame) };
+    espnow_stream_tx_t tx;
+    espnow_stream_rx_t rx;
+    setup(&tx, &rx, sizeof(frame));
+
+    for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        s_link.count = 0;
+        fill_frame(frame, sizes[i], i);
+        TEST_ASSERT_EQUAL(ESP_OK, espnow_stream_send_frame(&tx, frame, sizes[i]));
+        TEST_ASSERT_EQUAL_INT((sizes[i] + ESPNOW_STREAM_PAYLOAD_SIZE - 1) / ESPNOW_STREAM_PAYLOAD_SIZE, s_link.count);
+
+        for (int p = 0; p < s_link.count; ++p) {
+            deliver(&rx, p);
+        }
+
+        TEST_ASSERT_EQUAL_INT(i + 1, s_received.frames);
+        TEST_ASSERT_EQUAL_UINT32(i, s_received.frame_id);
+        TEST_ASSERT_EQUAL_UINT32(sizes[i], s_received.len);
+        TEST_ASSERT_EQUAL_MEMORY(frame, s_received.frame, sizes[i]);
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(0, rx.stats.frames_dropped);
+    TEST_ASSERT_EQUAL_UINT32(0, rx.stats.fragments_invalid);
+    espnow_stream_rx_deinit(&rx);
+}
+
+TEST_CASE("ESP-NOW stream reassembles reordered and duplicated fragments", "[espnow_stream]")
+{
+    static uint8_t frame[10 * ESPNOW_STREAM_PAYLOAD_SIZE + 17];
+    espnow_stream_tx_t tx;
+    espnow_stream_rx_t rx;
+    setup(&tx, &rx, sizeof(frame));
+
+    fill_frame(frame, sizeof(frame), 42);
+    TEST_ASSERT_EQUAL(ESP_OK, espnow_stream_send_frame(&tx, frame, sizeof(frame)));
+
+    // Last fragment first, then every other one, each of them twice
+    deliver(&rx, s_link.count - 1);
+    for (int p = 0; p < s_link.count - 1; p += 2) {
+        deliver(&rx, p);
+        deliver(&rx, p);
+    }
+    TEST_ASSERT_EQUAL_INT(0, s_received.frames);
+    for (int p = 1; p < s_link.count - 1; p += 2) {
+        deliver(&rx, p);
+    }
+
+    TEST_ASSERT_EQUAL_INT(1, s_received.frames);
+    TEST_ASSERT_EQUAL_MEMORY(frame, s_received.frame, sizeof(frame));
+
+    // Late duplicates of a finished frame must not deliver it again
+    deliver(&rx, 0);
+    TEST_ASSERT_EQUAL_INT(1, s_received.frames);
+    TEST_ASSERT_EQUAL_UINT32(s_link.count / 2 + 1, rx.stats.fragments_ignored);
+    espnow_stream_rx_deinit(&rx);
+}
+
+TEST_CASE("ESP-NOW stream drops a frame with a lost fragment when the next one starts", "[espnow_stream]")
+{
+    static uint8_t first[5 * ESPNOW_STREAM_PAYLOAD_SIZE];
+    static uint8_t second[4 * ESPNOW_STREAM_PAYLOAD_SIZE];
+    espnow_stream_tx_t tx;
+    espnow_stream_rx_t rx;
+    setup(&tx, &rx, sizeof(first));
+
+    fill_frame(first, sizeof(first), 1);
+    fill_frame(second, sizeof(second), 2);
+    TEST_ASSERT_EQUAL(ESP_OK, espnow_stream_send_frame(&tx, first, sizeof(first)));
+    int first_count = s_link.count;
+    TEST_ASSERT_EQUAL(ESP_OK, espnow_stream_send_frame(&tx, second, sizeof(second)));
+
+    for (int p = 0; p < s_link.count; ++p) {
+        if (p != 2) {
+            deliver(&rx, p);
+        }
+    }
+    // The lost fragment shows up after the frame was given up on
+    deliver(&rx, 2);
+
+    TEST_ASSERT_EQUAL_INT(1, s_received.frames);
+    TEST_ASSERT_EQUAL_UINT32(1, s_received.frame_id);
+    TEST_ASSERT_EQUAL_MEMORY(second, s_received.frame, sizeof(second));
+    TEST_ASSERT_EQUAL_UINT32(1, rx.stats.frames_dropped);
+    TEST_ASSERT_EQUAL_UINT32(1, rx.stats.fragments_ignored);
+    TEST_ASSERT_TRUE(first_count > 2);
+    espnow_stream_rx_deinit(&rx);
+}
+
+TEST_CASE("ESP-NOW stream frame ids wrap around", "[espnow_stream]")
+{
+    uint8_t frame[100];
+    espnow_stream_tx_t tx;
+    espnow_stream_rx_t rx;
+    setup(&tx, &rx, sizeof(frame));
+    tx.next_frame_id = UINT16_MAX - 1;
+
+    for (int i = 0; i < 4; ++i) {
+        s_link.count = 0;
+        fill_frame(frame, sizeof(frame), i);
+        TEST_ASSERT_EQUAL(ESP_OK, espnow_stream_send_frame(&tx, frame, sizeof(frame)));
+        deliver(&rx, 0);
+        TEST_ASSERT_EQUAL_INT(i + 1, s_received.frames);
+        TEST_ASSERT_EQUAL_UINT32((uint16_t)(UINT16_MAX - 1 + i), s_received.frame_id);
+    }
+    espnow_stream_rx_deinit(&rx);
+}
+
+TEST_CASE("ESP-NOW stream rejects malformed and oversized fragments", "[espnow_stream]")
+{
+    static uint8_t frame[3 * ESPNOW_STREAM_PAYLOAD_SIZE];
+    espnow_stream_tx_t tx;
+    espnow_stream_rx_t rx;
+    setup(&tx, &rx, 2 * ESPNOW_STREAM_PAYLOAD_SIZE);
+
+    fill_frame(frame, sizeof(frame), 3);
+    TEST_ASSERT_EQUAL(ESP_OK, espnow_stream_send_frame(&tx, frame, sizeof(frame)));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, espnow_stream_rx_feed(&rx, s_link.packets[0], s_link.lens[0]));
+
+    uint8_t packet[ESPNOW_STREAM_PACKET_SIZE];
+    memcpy(packet, s_link.packets[0], sizeof(packet));
+    packet[0] = 0;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, espnow_stream_rx_feed(&rx, packet, sizeof(packet)));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, espnow_stream_rx_feed(&rx, s_link.packets[0], ESPNOW_STREAM_HEADER_SIZE));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, espnow_stream_rx_feed(&rx, s_link.packets[0], s_link.lens[0] - 1));
+
+    memcpy(packet, s_link.packets[0], sizeof(packet));
+    packet[4] = 0;
+    packet[5] = 3;  // index past the fragment count
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, espnow_stream_rx_feed(&rx, packet, sizeof(packet)));
+
+    TEST_ASSERT_EQUAL_INT(0, s_received.frames);
+    espnow_stream_rx_deinit(&rx);
+}
+
+TEST_CASE("ESP-NOW stream stops sending a frame the link refuses", "[espnow_stream]")
+{
+    static uint8_t frame[4 * ESPNOW_STREAM_PAYLOAD_SIZE];
+    espnow_stream_tx_t tx;
+    espnow_stream_rx_t rx;
+    setup(&tx, &rx, sizeof(frame));
+
+    s_link.fail_at = 2;
+    TEST_ASSERT_EQUAL(ESP_FAIL, espnow_stream_send_frame(&tx, frame, sizeof(frame)));
+    TEST_ASSERT_EQUAL_INT(2, s_link.count);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, espnow_stream_send_frame(&tx, frame, 0));
+    espnow_stream_rx_deinit(&rx);
+}
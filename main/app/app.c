@@ -1,8 +1,12 @@
 #include "app.h"
+#include "pipeline.h"
+#include "network/espnow_transport.h"
+#include "network/mdns_service.h"
 #include "network/server.h"
 #include "network/wifi.h"
 #include "network/tasks.h"
 #include "camera/camera.h"
+#include "camera/history.h"
 
 #include <esp_log.h>
 #include <esp_camera.h>
@@ -31,6 +35,9 @@ status_t app_init() {
 	status = wifi_init();
 	CHECK_STATUS(status);
 
+	status = pipeline_validate();
+	CHECK_STATUS(status);
+
 	status = camera_init();
 	CHECK_STATUS(status);
 
@@ -40,16 +47,20 @@ status_t app_init() {
 void app_run() {
 	server_start();
 
-	task_sync.event_group = xEventGroupCreate();
-	task_sync.mutex = xSemaphoreCreateMutex();
-	task_sync.image_produce_queue = xQueueCreate(1, sizeof(camera_fb_t*));
-	task_sync.image_recycle_queue = xQueueCreate(1, sizeof(camera_fb_t*));
+	// Clients can still find the camera through the discovery broadcasts
+	if (ST_SUCCESS != mdns_service_start()) {
+		ESP_LOGW(TAG, "mDNS advertisement is unavailable");
+	}
+
+	if (ST_SUCCESS != espnow_transport_start()) {
+		ESP_LOGW(TAG, "ESP-NOW streaming is unavailable");
+	}
 
-	xTaskCreatePinnedToCore(task_send_camera_image, "Send image", 4096, &task_sync, PRIORITY_HIGH, NULL, 0);
-	xTaskCreatePinnedToCore(task_accept_new_clients, "Accept new clients", 4096, &task_sync, PRIORITY_NORMAL, NULL, 0);
-	xTaskCreatePinnedToCore(task_handle_requests, "Handle requests", 4096, &task_sync, PRIORITY_NORMAL, NULL, 0);
-	xTaskCreatePinnedToCore(task_send_broadcasts, "Broadcasts", 4096, &task_sync, PRIORITY_LOW, NULL, 0);
+	if (ST_SUCCESS != history_init()) {
+		ESP_LOGW(TAG, "Frame history is unavailable");
+	}
 
-	xTaskCreatePinnedToCore(task_capture_camera_image, "Capture image", 4096, &task_sync, PRIORITY_HIGH, NULL, 1);
-	xTaskCreatePinnedToCore(task_recycle_camera_image, "Recycle image", 4096, &task_sync, PRIORITY_HIGH, NULL, 1);
+	if (ST_SUCCESS != pipeline_start(&task_sync)) {
+		ESP_LOGE(TAG, "Failed to start the streaming pipeline");
+	}
 }
@@ -0,0 +1,34 @@
+#include "latency.h"
+
+// Each stage is recorded by exactly one task, so the counters need no locking.
+// Readers may see a histogram that is one sample behind, which is fine for aggregates.
+static volatile latency_histogram_t histograms_state[NUM_LATENCY_STAGES];
+
+static int bucket_index(uint32_t elapsed_us) {
+	uint32_t scaled = elapsed_us >> LATENCY_BUCKET_BASE_SHIFT;
+	if (!scaled) {
+		return 0;
+	}
+
+	int index = 32 - __builtin_clz(scaled);
+	return index < LATENCY_NUM_BUCKETS ? index : LATENCY_NUM_BUCKETS - 1;
+}
+
+void latency_record(latency_stage_t stage, int64_t elapsed_us) {
+	if (stage >= NUM_LATENCY_STAGES || elapsed_us < 0) {
+		return;
+	}
+
+	uint32_t elapsed = elapsed_us > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed_us;
+	volatile latency_histogram_t* histogram = &histograms_state[stage];
+	histogram->buckets[bucket_index(elapsed)] += 1;
+	if (elapsed > histogram->max_us) {
+		histogram->max_us = elapsed;
+	}
+}
+
+void latency_snapshot(latency_histogram_t histograms[NUM_LATENCY_STAGES]) {
+	for (int i = 0; i < NUM_LATENCY_STAGES; ++i) {
+		histograms[i] = histograms_state[i];
+	}
+}
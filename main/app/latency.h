@@ -0,0 +1,27 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+// Bucket 0 counts samples below 2^LATENCY_BUCKET_BASE_SHIFT us, bucket i (i > 0)
+// counts [2^(i + shift - 1), 2^(i + shift)) us, the last bucket also takes everything above
+#define LATENCY_NUM_BUCKETS 16
+#define LATENCY_BUCKET_BASE_SHIFT 8
+
+typedef enum {
+	LATENCY_VSYNC_TO_DEQUEUE,
+	LATENCY_DEQUEUE_TO_FIRST_PACKET,
+	LATENCY_SEND_DURATION,
+	LATENCY_RECYCLE_DELAY,
+	NUM_LATENCY_STAGES,
+} latency_stage_t;
+
+typedef struct {
+	uint32_t buckets[LATENCY_NUM_BUCKETS];
+	uint32_t max_us;
+} latency_histogram_t;
+
+void latency_record(latency_stage_t stage, int64_t elapsed_us);
+void latency_snapshot(latency_histogram_t histograms[NUM_LATENCY_STAGES]);
+
+#endif
@@ -0,0 +1,72 @@
+#include "link_policy.h"
+
+// A level is kept as long as the link meets its row; a better level is only entered
+// once the link clears that row by the hysteresis margin for a while
+#define RECOVERY_RSSI_MARGIN 5
+#define DEGRADE_SAMPLES 2
+#define RECOVER_SAMPLES 6
+// With one client a sample holds only a dozen or so sends, so a single lost send would already break
+// the failure ratio of the good row; fewer failures than this are not a burst and do not count
+#define MIN_TX_FAILURES 3
+
+typedef struct {
+	int8_t min_rssi;
+	uint16_t max_tx_failures_permille;
+} link_policy_row_t;
+
+static const link_policy_row_t policy_table[NUM_LINK_LEVELS] = {
+	[LINK_GOOD] = { -67, 20 },
+	[LINK_FAIR] = { -75, 100 },
+	[LINK_POOR] = { INT8_MIN, 1000 },
+};
+
+static bool meets_row(const link_sample_t* sample, link_level_t level, int rssi_margin) {
+	const link_policy_row_t* row = &policy_table[level];
+	if (sample->rssi < row->min_rssi + rssi_margin) {
+		return false;
+	}
+
+	if (sample->tx_failures < MIN_TX_FAILURES) {
+		return true;
+	}
+
+	return (uint64_t)sample->tx_failures * 1000 <= (uint64_t)row->max_tx_failures_permille * sample->tx_attempts;
+}
+
+void link_policy_init(link_policy_t* policy) {
+	policy->level = LINK_GOOD;
+	policy->degrading_samples = 0;
+	policy->recovering_samples = 0;
+}
+
+bool link_policy_update(link_policy_t* policy, const link_sample_t* sample) {
+	link_level_t level = policy->level;
+
+	if (!meets_row(sample, level, 0)) {
+		policy->recovering_samples = 0;
+		if (++policy->degrading_samples < DEGRADE_SAMPLES) {
+			return false;
+		}
+
+		// Drop straight to the first level the link still meets, not one step at a time
+		while (level < LINK_POOR && !meets_row(sample, level, 0)) {
+			level += 1;
+		}
+	} else if (level > LINK_GOOD && meets_row(sample, level - 1, RECOVERY_RSSI_MARGIN)) {
+		policy->degrading_samples = 0;
+		if (++policy->recovering_samples < RECOVER_SAMPLES) {
+			return false;
+		}
+
+		level -= 1;
+	} else {
+		policy->degrading_samples = 0;
+		policy->recovering_samples = 0;
+		return false;
+	}
+
+	policy->degrading_samples = 0;
+	policy->recovering_samples = 0;
+	policy->level = level;
+	return true;
+}
@@ -0,0 +1,32 @@
+#ifndef LINK_POLICY_H
+#define LINK_POLICY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Plain C without ESP-IDF dependencies, so tools/link_policy_sim.c can replay recorded traces on a host
+
+typedef enum {
+	LINK_GOOD = 0,
+	LINK_FAIR = 1,
+	LINK_POOR = 2,
+	NUM_LINK_LEVELS,
+} link_level_t;
+
+typedef struct {
+	int8_t rssi;
+	uint32_t tx_attempts;	// frame sends since the previous sample
+	uint32_t tx_failures;
+} link_sample_t;
+
+typedef struct {
+	link_level_t level;
+	uint8_t degrading_samples;
+	uint8_t recovering_samples;
+} link_policy_t;
+
+void link_policy_init(link_policy_t* policy);
+// Returns true when the level changed
+bool link_policy_update(link_policy_t* policy, const link_sample_t* sample);
+
+#endif
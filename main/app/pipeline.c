@@ -0,0 +1,250 @@
+#include "pipeline.h"
+#include "camera/camera.h"
+#include "network/espnow_transport.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include <esp_camera.h>
+#include <esp_log.h>
+
+#define TAG "pipeline"
+
+#if CONFIG_CAMERA_CORE0
+#define CAM_TASK_CORE 0
+#elif CONFIG_CAMERA_CORE1
+#define CAM_TASK_CORE 1
+#else
+#define CAM_TASK_CORE PIPELINE_NO_AFFINITY
+#endif
+
+#define CAM_TASK_PRIORITY (configMAX_PRIORITIES - 2)
+
+#define SENSOR_CONTROL_QUEUE_DEPTH 4
+
+#if CONFIG_CAMERA_FB_POOL
+#define CAMERA_NUM_FRAMES (CAMERA_NUM_FRAMEBUFFERS * CAMERA_FB_POOL_FRAMES_PER_FB)
+#else
+#define CAMERA_NUM_FRAMES CAMERA_NUM_FRAMEBUFFERS
+#endif
+
+#define NETWORK_CORE CONFIG_PIPELINE_NETWORK_CORE
+#define CAMERA_CORE CONFIG_PIPELINE_CAMERA_CORE
+
+#if CONFIG_PIPELINE_BENCHMARK
+static void task_pipeline_benchmark(void* params);
+#endif
+
+static const pipeline_stage_t stages[] = {
+	{ "cam_task", NULL, CONFIG_CAMERA_TASK_STACK_SIZE, CAM_TASK_PRIORITY, CAM_TASK_CORE },
+	{ "Capture image", task_capture_camera_image, 4096, PRIORITY_HIGH, CAMERA_CORE },
+	{ "Recycle image", task_recycle_camera_image, 4096, PRIORITY_HIGH, CAMERA_CORE },
+	{ "Send image", task_send_camera_image, 4096, PRIORITY_HIGH, NETWORK_CORE },
+	{ "Accept clients", task_accept_new_clients, 4096, PRIORITY_NORMAL, NETWORK_CORE },
+	{ "Handle requests", task_handle_requests, 4096, PRIORITY_NORMAL, NETWORK_CORE },
+	{ "Discovery", task_send_broadcasts, 4096, PRIORITY_LOW, NETWORK_CORE },
+	{ "Heartbeats", task_send_heartbeats, 4096, PRIORITY_LOW, NETWORK_CORE },
+#if CONFIG_ESPNOW_TRANSPORT
+	{ "ESP-NOW send", task_send_espnow_frames, 4096, PRIORITY_LOW, NETWORK_CORE },
+#endif
+#if CONFIG_LINK_ADAPTATION
+	{ "Link monitor", task_monitor_link, 3072, PRIORITY_LOW, NETWORK_CORE },
+#endif
+#if CONFIG_PIPELINE_BENCHMARK
+	{ "Pipeline bench", task_pipeline_benchmark, 4096, PRIORITY_LOW, PIPELINE_NO_AFFINITY },
+#endif
+};
+
+static const pipeline_queue_t queues[] = {
+	{ "image produce", offsetof(task_sync_t, image_produce_queue), CONFIG_PIPELINE_FRAME_QUEUE_DEPTH, sizeof(captured_frame_t), true },
+	{ "image recycle", offsetof(task_sync_t, image_recycle_queue), CONFIG_PIPELINE_RECYCLE_QUEUE_DEPTH, sizeof(captured_frame_t), true },
+	{ "sensor control", offsetof(task_sync_t, sensor_control_queue), SENSOR_CONTROL_QUEUE_DEPTH, sizeof(sensor_control_batch_t), false },
+};
+
+#define NUM_STAGES (sizeof(stages) / sizeof(stages[0]))
+#define NUM_QUEUES (sizeof(queues) / sizeof(queues[0]))
+
+static TaskHandle_t stage_handles[NUM_STAGES];
+
+static bool is_valid_core(int core) {
+	return core == PIPELINE_NO_AFFINITY || (core >= 0 && core < portNUM_PROCESSORS);
+}
+
+status_t pipeline_validate() {
+	status_t status = ST_SUCCESS;
+
+	for (int i = 0; i < NUM_STAGES; ++i) {
+		const pipeline_stage_t* stage = &stages[i];
+		if (!is_valid_core(stage->core)) {
+			ESP_LOGE(TAG, "Stage '%s' is pinned to non-existent core %d", stage->name, stage->core);
+			status = ST_PIPELINE_INVALID;
+		}
+
+		if (stage->priority >= configMAX_PRIORITIES) {
+			ESP_LOGE(TAG, "Stage '%s' priority %u exceeds configMAX_PRIORITIES (%d)",
+					stage->name, stage->priority, configMAX_PRIORITIES);
+			status = ST_PIPELINE_INVALID;
+		}
+
+		// The driver's cam_task drains the DMA buffers; anything at or above it starves the sensor
+		if (stage->task && stage->priority >= CAM_TASK_PRIORITY) {
+			ESP_LOGE(TAG, "Stage '%s' priority %u would preempt cam_task (%d)",
+					stage->name, stage->priority, CAM_TASK_PRIORITY);
+			status = ST_PIPELINE_INVALID;
+		}
+
+		if (stage->task && stage->stack_size < configMINIMAL_STACK_SIZE) {
+			ESP_LOGE(TAG, "Stage '%s' stack size %u is below the minimum", stage->name, stage->stack_size);
+			status = ST_PIPELINE_INVALID;
+		}
+	}
+
+	UBaseType_t frames_in_queues = 0;
+	for (int i = 0; i < NUM_QUEUES; ++i) {
+		if (queues[i].depth == 0) {
+			ESP_LOGE(TAG, "Queue '%s' has zero depth", queues[i].name);
+			status = ST_PIPELINE_INVALID;
+		}
+		if (queues[i].holds_frames) {
+			frames_in_queues += queues[i].depth;
+		}
+	}
+
+	// Frames parked in the queues are unavailable to the driver
+	if (frames_in_queues >= CAMERA_NUM_FRAMES + 1) {
+		ESP_LOGW(TAG, "Queues can hold %u frames but only %d frame buffers are allocated; capture will stall",
+				frames_in_queues, CAMERA_NUM_FRAMES);
+	}
+
+	for (int i = 0; i < NUM_STAGES; ++i) {
+		ESP_LOGI(TAG, "Stage %-16s priority %2u core %2d%s", stages[i].name, stages[i].priority, stages[i].core,
+				stages[i].task ? "" : " (driver)");
+	}
+
+	return status;
+}
+
+status_t pipeline_start(task_sync_t* task_sync) {
+	task_sync->event_group = xEventGroupCreate();
+	task_sync->mutex = xSemaphoreCreateMutex();
+
+	for (int i = 0; i < NUM_QUEUES; ++i) {
+		QueueHandle_t* queue = (QueueHandle_t*)((uint8_t*)task_sync + queues[i].sync_offset);
+		*queue = xQueueCreate(queues[i].depth, queues[i].item_size);
+		if (!*queue) {
+			ESP_LOGE(TAG, "Failed to create queue '%s'", queues[i].name);
+			return ST_PIPELINE_INVALID;
+		}
+	}
+
+	for (int i = 0; i < NUM_STAGES; ++i) {
+		const pipeline_stage_t* stage = &stages[i];
+		if (!stage->task) {
+			continue;
+		}
+
+		BaseType_t core = stage->core == PIPELINE_NO_AFFINITY ? tskNO_AFFINITY : stage->core;
+		if (pdPASS != xTaskCreatePinnedToCore(stage->task, stage->name, stage->stack_size, task_sync,
+					stage->priority, &stage_handles[i], core)) {
+			ESP_LOGE(TAG, "Failed to start stage '%s'", stage->name);
+			return ST_PIPELINE_INVALID;
+		}
+	}
+
+	return ST_SUCCESS;
+}
+
+#if CONFIG_PIPELINE_BENCHMARK
+
+#define MAX_TRACKED_TASKS 32
+
+typedef struct {
+	TaskHandle_t handle;
+	uint32_t run_time;
+} task_sample_t;
+
+static task_sample_t previous_samples[MAX_TRACKED_TASKS];
+static int num_previous_samples;
+static uint32_t previous_total_run_time;
+
+static uint32_t previous_run_time(TaskHandle_t handle) {
+	for (int i = 0; i < num_previous_samples; ++i) {
+		if (previous_samples[i].handle == handle) {
+			return previous_samples[i].run_time;
+		}
+	}
+	return 0;
+}
+
+static int find_stage(const TaskStatus_t* status) {
+	for (int i = 0; i < NUM_STAGES; ++i) {
+		if (stage_handles[i] ? stage_handles[i] == status->xHandle : !strcmp(stages[i].name, status->pcTaskName)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void report_core(int core, const TaskStatus_t* statuses, int num_statuses, uint32_t elapsed) {
+	uint32_t stages_total = 0;
+	for (int i = 0; i < num_statuses; ++i) {
+		int stage = find_stage(&statuses[i]);
+		if (stage < 0 || stages[stage].core != core) {
+			continue;
+		}
+
+		uint32_t delta = statuses[i].ulRunTimeCounter - previous_run_time(statuses[i].xHandle);
+		stages_total += delta;
+		ESP_LOGI(TAG, "  core %2d %-16s %10u (%3u%%)", core, stages[stage].name, delta,
+				(unsigned)((uint64_t)delta * 100 / elapsed));
+	}
+
+	ESP_LOGI(TAG, "  core %2d %-16s %10u (%3u%%)", core, "all stages", stages_total,
+			(unsigned)((uint64_t)stages_total * 100 / elapsed));
+
+	if (core == PIPELINE_NO_AFFINITY) {
+		return;
+	}
+
+	TaskHandle_t idle_task = xTaskGetIdleTaskHandleForCPU(core);
+	for (int i = 0; i < num_statuses; ++i) {
+		if (statuses[i].xHandle == idle_task) {
+			uint32_t delta = statuses[i].ulRunTimeCounter - previous_run_time(idle_task);
+			ESP_LOGI(TAG, "  core %2d %-16s %10u (%3u%%)", core, "idle", delta,
+					(unsigned)((uint64_t)delta * 100 / elapsed));
+		}
+	}
+}
+
+static void task_pipeline_benchmark(void* params) {
+	static TaskStatus_t statuses[MAX_TRACKED_TASKS];
+
+	while(1) {
+		vTaskDelay(pdMS_TO_TICKS(CONFIG_PIPELINE_BENCHMARK_INTERVAL_MS));
+
+		uint32_t total_run_time;
+		int num_statuses = uxTaskGetSystemState(statuses, MAX_TRACKED_TASKS, &total_run_time);
+		if (num_statuses == 0) {
+			ESP_LOGW(TAG, "Too many tasks to sample");
+			continue;
+		}
+
+		uint32_t elapsed = total_run_time - previous_total_run_time;
+		if (previous_total_run_time && elapsed) {
+			ESP_LOGI(TAG, "Per-stage CPU time over the last %d ms:", CONFIG_PIPELINE_BENCHMARK_INTERVAL_MS);
+			for (int core = 0; core < portNUM_PROCESSORS; ++core) {
+				report_core(core, statuses, num_statuses, elapsed);
+			}
+			report_core(PIPELINE_NO_AFFINITY, statuses, num_statuses, elapsed);
+		}
+
+		for (int i = 0; i < num_statuses; ++i) {
+			previous_samples[i].handle = statuses[i].xHandle;
+			previous_samples[i].run_time = statuses[i].ulRunTimeCounter;
+		}
+		num_previous_samples = num_statuses;
+		previous_total_run_time = total_run_time;
+	}
+}
+
+#endif
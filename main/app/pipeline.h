@@ -0,0 +1,33 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "prelude.h"
+#include "network/tasks.h"
+
+#include <stdbool.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define PIPELINE_NO_AFFINITY -1
+
+typedef struct {
+	const char* name;
+	TaskFunction_t task;	// NULL for stages owned by a driver (e.g. cam_task)
+	uint32_t stack_size;
+	UBaseType_t priority;
+	int core;
+} pipeline_stage_t;
+
+typedef struct {
+	const char* name;
+	size_t sync_offset;	// offset of the queue handle inside task_sync_t
+	UBaseType_t depth;
+	UBaseType_t item_size;
+	bool holds_frames;	// items keep a driver frame buffer checked out
+} pipeline_queue_t;
+
+status_t pipeline_validate();
+status_t pipeline_start(task_sync_t* task_sync);
+
+#endif
@@ -0,0 +1,49 @@
+#include "telemetry.h"
+
+#include <esp_camera.h>
+#include <esp_timer.h>
+
+// Every field has a single writer, so plain 32-bit stores are enough
+static volatile telemetry_t telemetry_state;
+
+void telemetry_count_captured_frame() {
+	telemetry_state.frames_captured += 1;
+}
+
+void telemetry_count_skipped_frame() {
+	telemetry_state.frames_skipped += 1;
+}
+
+void telemetry_set_consumer_lag(uint16_t lag) {
+	telemetry_state.consumer_lag = lag;
+}
+
+void telemetry_set_throttle_state(uint8_t state) {
+	if (telemetry_state.throttle_state != state) {
+		telemetry_state.throttle_transitions += 1;
+	}
+	telemetry_state.throttle_state = state;
+}
+
+void telemetry_record_wifi_reconnect(uint32_t reconnect_ms) {
+	telemetry_state.wifi_reconnects += 1;
+	telemetry_state.last_reconnect_ms = reconnect_ms;
+}
+
+void telemetry_set_link(int8_t rssi, uint8_t link_level) {
+	telemetry_state.rssi = rssi;
+	telemetry_state.link_level = link_level;
+}
+
+void telemetry_snapshot(telemetry_t* telemetry) {
+	*telemetry = telemetry_state;
+	telemetry->uptime_ms = esp_timer_get_time() / 1000;
+
+	camera_stats_t camera_stats;
+	if (esp_camera_get_stats(&camera_stats) == ESP_OK) {
+		telemetry->camera_no_soi = camera_stats.no_soi;
+		telemetry->camera_no_eoi = camera_stats.no_eoi;
+		telemetry->camera_fb_overflows = camera_stats.fb_overflow;
+		telemetry->camera_queue_drops = camera_stats.fbq_receive + camera_stats.fbq_send;
+	}
+}
@@ -0,0 +1,34 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+
+typedef struct {
+	uint32_t uptime_ms;
+	uint32_t frames_captured;
+	uint32_t frames_skipped;
+	uint32_t throttle_transitions;
+	uint16_t consumer_lag;
+	uint8_t throttle_state;
+	uint8_t num_clients;
+	uint32_t wifi_reconnects;
+	uint32_t last_reconnect_ms;	// from losing the AP to having an IP again
+	int8_t rssi;
+	uint8_t link_level;
+	// Frames the camera driver dropped, see camera_stats_t
+	uint32_t camera_no_soi;
+	uint32_t camera_no_eoi;
+	uint32_t camera_fb_overflows;
+	uint32_t camera_queue_drops;
+} telemetry_t;
+
+void telemetry_count_captured_frame();
+void telemetry_count_skipped_frame();
+void telemetry_set_consumer_lag(uint16_t lag);
+void telemetry_set_throttle_state(uint8_t state);
+void telemetry_record_wifi_reconnect(uint32_t reconnect_ms);
+void telemetry_set_link(int8_t rssi, uint8_t link_level);
+
+void telemetry_snapshot(telemetry_t* telemetry);
+
+#endif
@@ -0,0 +1,134 @@
+#include "trace.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+
+#define TAG "trace"
+
+#if CONFIG_HOT_PATH_TRACE
+
+#define TRACE_BUFFER_MASK (CONFIG_HOT_PATH_TRACE_EVENTS - 1)
+
+_Static_assert((CONFIG_HOT_PATH_TRACE_EVENTS & TRACE_BUFFER_MASK) == 0, "Trace buffer size must be a power of two");
+
+typedef struct {
+	trace_event_t events[CONFIG_HOT_PATH_TRACE_EVENTS];
+	uint32_t head;
+} trace_ring_t;
+
+static const char* stage_names[NUM_TRACE_STAGES] = {
+	[TRACE_STAGE_CAM_TASK] = "cam_task",
+	[TRACE_STAGE_CAPTURE] = "capture",
+	[TRACE_STAGE_SEND] = "send",
+	[TRACE_STAGE_RECYCLE] = "recycle",
+	[TRACE_STAGE_REQUESTS] = "requests",
+};
+
+static const char* event_names[NUM_TRACE_EVENTS] = {
+	[TRACE_CAM_FRAME] = "cam frame",
+	[TRACE_FRAME_CAPTURE] = "frame capture",
+	[TRACE_FRAME_ENQUEUE] = "frame enqueue",
+	[TRACE_FRAME_SEND] = "frame send",
+	[TRACE_FRAME_RECYCLE] = "frame recycle",
+	[TRACE_FRAME_SKIPPED] = "frame skipped",
+	[TRACE_FRAME_CAPTURE_FAILED] = "capture failed",
+	[TRACE_FRAME_SEND_FAILED] = "send failed",
+	[TRACE_REQUEST_RECEIVED] = "request received",
+};
+
+static const char phase_names[] = { 'i', 'B', 'E', 'X' };
+
+// One ring per core keeps the two cores from contending on the same head index
+static trace_ring_t rings[portNUM_PROCESSORS];
+
+static void write_event(uint32_t timestamp_us, trace_stage_t stage, trace_event_id_t event, trace_phase_t phase,
+		uint8_t arg0, uint32_t arg1) {
+	trace_ring_t* ring = &rings[xPortGetCoreID()];
+	// Tasks on the same core may preempt each other, so the slot is still claimed atomically
+	uint32_t index = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED) & TRACE_BUFFER_MASK;
+	trace_event_t* slot = &ring->events[index];
+	slot->timestamp_us = timestamp_us;
+	slot->event = event;
+	slot->phase = phase;
+	slot->stage = stage;
+	slot->arg0 = arg0;
+	slot->arg1 = arg1;
+}
+
+void trace_record(trace_stage_t stage, trace_event_id_t event, trace_phase_t phase, uint8_t arg0, uint32_t arg1) {
+	write_event((uint32_t)esp_timer_get_time(), stage, event, phase, arg0, arg1);
+}
+
+void trace_record_complete(trace_stage_t stage, trace_event_id_t event, int64_t start_us, int64_t end_us) {
+	uint32_t duration_us = end_us > start_us ? (uint32_t)(end_us - start_us) : 0;
+	write_event((uint32_t)start_us, stage, event, TRACE_PHASE_COMPLETE, 0, duration_us);
+}
+
+uint32_t trace_get_head(int core) {
+	return __atomic_load_n(&rings[core].head, __ATOMIC_ACQUIRE);
+}
+
+uint32_t trace_get_tail(int core) {
+	uint32_t head = trace_get_head(core);
+	return head > CONFIG_HOT_PATH_TRACE_EVENTS ? head - CONFIG_HOT_PATH_TRACE_EVENTS : 0;
+}
+
+size_t trace_read(int core, uint32_t* position, trace_event_t* events, size_t max_events) {
+	uint32_t head = trace_get_head(core);
+	uint32_t tail = trace_get_tail(core);
+	if (*position < tail) {
+		*position = tail;
+	}
+
+	// Events being overwritten while they are copied may come out torn; the host tool tolerates that
+	size_t num_events = 0;
+	for (; *position < head && num_events < max_events; ++*position) {
+		events[num_events++] = rings[core].events[*position & TRACE_BUFFER_MASK];
+	}
+
+	return num_events;
+}
+
+void trace_dump() {
+	for (int core = 0; core < portNUM_PROCESSORS; ++core) {
+		uint32_t head = trace_get_head(core);
+		uint32_t tail = trace_get_tail(core);
+
+		ESP_LOGI(TAG, "Core %d: %u trace events", core, head - tail);
+		for (uint32_t i = tail; i < head; ++i) {
+			const trace_event_t* event = &rings[core].events[i & TRACE_BUFFER_MASK];
+			const char* stage = event->stage < NUM_TRACE_STAGES ? stage_names[event->stage] : "unknown";
+			const char* name = event->event < NUM_TRACE_EVENTS ? event_names[event->event] : "unknown";
+			char phase = event->phase < sizeof(phase_names) ? phase_names[event->phase] : '?';
+			ESP_LOGI(TAG, "%10u us %-9s %c %-16s %3u %u", event->timestamp_us, stage, phase, name,
+					event->arg0, event->arg1);
+		}
+	}
+}
+
+#else
+
+void trace_record(trace_stage_t stage, trace_event_id_t event, trace_phase_t phase, uint8_t arg0, uint32_t arg1) {
+}
+
+void trace_record_complete(trace_stage_t stage, trace_event_id_t event, int64_t start_us, int64_t end_us) {
+}
+
+uint32_t trace_get_head(int core) {
+	return 0;
+}
+
+uint32_t trace_get_tail(int core) {
+	return 0;
+}
+
+size_t trace_read(int core, uint32_t* position, trace_event_t* events, size_t max_events) {
+	return 0;
+}
+
+void trace_dump() {
+	ESP_LOGW(TAG, "Hot path tracing is disabled");
+}
+
+#endif
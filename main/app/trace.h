@@ -0,0 +1,70 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Numbering is part of the trace export protocol, see tools/trace_to_chrome.py
+typedef enum {
+	TRACE_STAGE_CAM_TASK,
+	TRACE_STAGE_CAPTURE,
+	TRACE_STAGE_SEND,
+	TRACE_STAGE_RECYCLE,
+	TRACE_STAGE_REQUESTS,
+	NUM_TRACE_STAGES,
+} trace_stage_t;
+
+typedef enum {
+	TRACE_CAM_FRAME,			// span from VSYNC to the frame being handed out by the driver
+	TRACE_FRAME_CAPTURE,		// span around esp_camera_fb_get, arg1: frame length
+	TRACE_FRAME_ENQUEUE,		// span while waiting for room in the produce queue
+	TRACE_FRAME_SEND,			// span around sending to all clients, arg1: frame length
+	TRACE_FRAME_RECYCLE,		// span around returning the frame to the driver
+	TRACE_FRAME_SKIPPED,		// arg0: consumer lag in frames
+	TRACE_FRAME_CAPTURE_FAILED,
+	TRACE_FRAME_SEND_FAILED,	// arg0: client index, arg1: errno (UINT32_MAX when all clients failed)
+	TRACE_REQUEST_RECEIVED,		// arg0: client index, arg1: received bytes
+	NUM_TRACE_EVENTS,
+} trace_event_id_t;
+
+typedef enum {
+	TRACE_PHASE_INSTANT,
+	TRACE_PHASE_BEGIN,
+	TRACE_PHASE_END,
+	TRACE_PHASE_COMPLETE,		// timestamp is the span start, arg1 its duration in us
+} trace_phase_t;
+
+typedef struct {
+	uint32_t timestamp_us;
+	uint8_t event;
+	uint8_t phase;
+	uint8_t stage;
+	uint8_t arg0;
+	uint32_t arg1;
+} trace_event_t;
+
+#if CONFIG_HOT_PATH_TRACE
+#define TRACE_EVENT(stage, event, arg0, arg1) trace_record((stage), (event), TRACE_PHASE_INSTANT, (arg0), (arg1))
+#define TRACE_BEGIN(stage, event) trace_record((stage), (event), TRACE_PHASE_BEGIN, 0, 0)
+#define TRACE_END(stage, event, arg1) trace_record((stage), (event), TRACE_PHASE_END, 0, (arg1))
+#define TRACE_COMPLETE(stage, event, start_us, end_us) trace_record_complete((stage), (event), (start_us), (end_us))
+#else
+// Arguments are not evaluated, so disabled tracing costs nothing on the hot path
+#define TRACE_EVENT(stage, event, arg0, arg1) do {} while (0)
+#define TRACE_BEGIN(stage, event) do {} while (0)
+#define TRACE_END(stage, event, arg1) do {} while (0)
+#define TRACE_COMPLETE(stage, event, start_us, end_us) do {} while (0)
+#endif
+
+void trace_record(trace_stage_t stage, trace_event_id_t event, trace_phase_t phase, uint8_t arg0, uint32_t arg1);
+void trace_record_complete(trace_stage_t stage, trace_event_id_t event, int64_t start_us, int64_t end_us);
+
+// Positions are absolute and only grow; events older than the ring size are gone
+uint32_t trace_get_head(int core);
+uint32_t trace_get_tail(int core);
+// Copies events starting at *position (moved forward past overwritten ones) and advances it
+size_t trace_read(int core, uint32_t* position, trace_event_t* events, size_t max_events);
+
+void trace_dump();
+
+#endif
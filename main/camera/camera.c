@@ -1,12 +1,26 @@
 #include "camera/camera.h"
 #include "esp_camera.h"
 #include "esp_log.h"
+#include "nvs.h"
+
+#include <stdio.h>
 
 #define CAMERA_MODEL_AI_THINKER
 #include "camera_pins.h"
 
 #define TAG "camera"
 
+#define XCLK_FREQ_HZ 20000000
+#define JPEG_QUALITY 12
+// Highest quality scale the sensors take; OV5640 keeps only the low six bits of larger values
+#define JPEG_QUALITY_MAX 63
+
+#define FB_SIZE_NAMESPACE "camera"
+// One key per frame size, a size learned for another one would undersize or waste the buffers
+#define FB_SIZE_KEY_FORMAT "jpeg_fb_size_%d"
+// Frames between two looks at the driver's size suggestion
+#define FB_SIZE_CHECK_FRAMES 1000
+
 static camera_config_t config = {
 	.pin_pwdn = PWDN_GPIO_NUM,
 	.pin_reset = RESET_GPIO_NUM,
@@ -24,17 +38,111 @@ static camera_config_t config = {
 	.pin_vsync = VSYNC_GPIO_NUM,
 	.pin_href = HREF_GPIO_NUM,
 	.pin_pclk = PCLK_GPIO_NUM,
-	.xclk_freq_hz = 20000000,
+	.xclk_freq_hz = XCLK_FREQ_HZ,
 	.ledc_timer = LEDC_TIMER_0,
 	.ledc_channel = LEDC_CHANNEL_0,
 	.pixel_format = PIXFORMAT_JPEG,
 	.fb_location = CAMERA_FB_IN_PSRAM,
 	.frame_size = FRAMESIZE_SVGA,
-	.jpeg_quality = 12,
+	.jpeg_quality = JPEG_QUALITY,
 	.fb_count = CAMERA_NUM_FRAMEBUFFERS,
+#if CONFIG_CAMERA_FB_POOL
+	.fb_pool = true,
+#endif
 };
 
+static uint32_t stored_fb_size;
+static uint32_t fb_size_checked_at;
+// Frames of a smaller frame size say nothing about the buffers the configured one needs, so
+// learning pauses until the next restart once a client picked one
+static bool framesize_reduced;
+
+static void get_fb_size_key(char key[NVS_KEY_NAME_MAX_SIZE]) {
+	snprintf(key, NVS_KEY_NAME_MAX_SIZE, FB_SIZE_KEY_FORMAT, config.frame_size);
+}
+
+// The default sizing assumes the worst case JPEG of width * height / 5 per buffer. A size learned
+// from earlier runs is usually much smaller, so the same PSRAM holds more buffers.
+static void load_fb_size() {
+	nvs_handle_t handle;
+	if (nvs_open(FB_SIZE_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+		return;
+	}
+	char key[NVS_KEY_NAME_MAX_SIZE];
+	get_fb_size_key(key);
+	bool has_size = nvs_get_u32(handle, key, &stored_fb_size) == ESP_OK;
+	nvs_close(handle);
+
+	size_t worst_case_size = resolution[config.frame_size].width * resolution[config.frame_size].height / 5;
+	if (!has_size || stored_fb_size == 0 || stored_fb_size > 2 * worst_case_size) {
+		stored_fb_size = 0;
+		return;
+	}
+
+	size_t fb_count = worst_case_size * CAMERA_NUM_FRAMEBUFFERS / stored_fb_size;
+	if (fb_count < CAMERA_NUM_FRAMEBUFFERS) {
+		fb_count = CAMERA_NUM_FRAMEBUFFERS;
+	} else if (fb_count > CAMERA_MAX_FRAMEBUFFERS) {
+		fb_count = CAMERA_MAX_FRAMEBUFFERS;
+	}
+
+	config.jpeg_fb_size = stored_fb_size;
+	config.fb_count = fb_count;
+	ESP_LOGI(TAG, "Using %u frame buffers of %u bytes learned from earlier frames", fb_count, stored_fb_size);
+}
+
+void camera_persist_fb_size() {
+	camera_fb_size_histogram_t histogram;
+	if (framesize_reduced || esp_camera_get_fb_size_histogram(&histogram) != ESP_OK || histogram.count - fb_size_checked_at < FB_SIZE_CHECK_FRAMES) {
+		return;
+	}
+	fb_size_checked_at = histogram.count;
+
+	// Every write wears the flash, so only sizes that differ by more than an eighth are stored
+	uint32_t suggested = esp_camera_suggest_jpeg_fb_size();
+	uint32_t current = stored_fb_size ? stored_fb_size : histogram.fb_size;
+	uint32_t difference = suggested > current ? suggested - current : current - suggested;
+	if (!suggested || difference <= current / 8) {
+		return;
+	}
+
+	nvs_handle_t handle;
+	if (nvs_open(FB_SIZE_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+		return;
+	}
+	char key[NVS_KEY_NAME_MAX_SIZE];
+	get_fb_size_key(key);
+	if (nvs_set_u32(handle, key, suggested) == ESP_OK && nvs_commit(handle) == ESP_OK) {
+		stored_fb_size = suggested;
+		ESP_LOGI(TAG, "Frames of up to %u bytes seen, frame buffers will be %u bytes after the next restart",
+				histogram.max_len, suggested);
+	}
+	nvs_close(handle);
+}
+
+// Every frame size a client may pick fits the buffers allocated for the configured one. With their
+// registers worked out up front, the sensor switches between them without a full reconfiguration.
+static void load_mode_presets() {
+	sensor_t* sensor = esp_camera_sensor_get();
+	camera_sensor_info_t* sensor_info = sensor ? esp_camera_sensor_get_info(&sensor->id) : NULL;
+	if (!sensor_info || !sensor->set_mode_presets) {
+		return;
+	}
+
+	framesize_t framesizes[FRAMESIZE_INVALID];
+	int num_framesizes = 0;
+	for (int size = 0; size <= config.frame_size && size <= sensor_info->max_size; ++size) {
+		framesizes[num_framesizes++] = (framesize_t)size;
+	}
+
+	if (sensor->set_mode_presets(sensor, framesizes, num_framesizes) != 0) {
+		ESP_LOGW(TAG, "No frame size presets, frame size changes reconfigure the sensor");
+	}
+}
+
 status_t camera_init() {
+	load_fb_size();
+
 	esp_err_t error = esp_camera_init(&config);
 	if (error) {
 		const char* error_name = get_error_name(error);
@@ -44,5 +152,181 @@ status_t camera_init() {
 		ESP_LOGI(TAG, "Camera initialized successfully");
 	}
 
+	load_mode_presets();
+
+	return ST_SUCCESS;
+}
+
+typedef struct {
+	int16_t min;
+	int16_t max;
+} sensor_control_range_t;
+
+static const sensor_control_range_t sensor_control_ranges[NUM_SENSOR_SETTINGS] = {
+	[SENSOR_QUALITY] = { 0, 63 },
+	[SENSOR_FRAMESIZE] = { 0, FRAMESIZE_INVALID - 1 },
+	[SENSOR_BRIGHTNESS] = { -2, 2 },
+	[SENSOR_CONTRAST] = { -2, 2 },
+	[SENSOR_SATURATION] = { -2, 2 },
+	[SENSOR_SHARPNESS] = { -2, 2 },
+	[SENSOR_WHITEBAL] = { 0, 1 },
+	[SENSOR_AWB_GAIN] = { 0, 1 },
+	[SENSOR_WB_MODE] = { 0, 4 },
+	[SENSOR_EXPOSURE_CTRL] = { 0, 1 },
+	[SENSOR_AEC2] = { 0, 1 },
+	[SENSOR_AE_LEVEL] = { -2, 2 },
+	[SENSOR_AEC_VALUE] = { 0, 1200 },
+	[SENSOR_GAIN_CTRL] = { 0, 1 },
+	[SENSOR_AGC_GAIN] = { 0, 30 },
+	[SENSOR_GAINCEILING] = { GAINCEILING_2X, GAINCEILING_128X },
+	[SENSOR_HMIRROR] = { 0, 1 },
+	[SENSOR_VFLIP] = { 0, 1 },
+	[SENSOR_SPECIAL_EFFECT] = { 0, 6 },
+};
+
+status_t camera_get_info(camera_info_t* info) {
+	sensor_t* sensor = esp_camera_sensor_get();
+	camera_sensor_info_t* sensor_info = sensor ? esp_camera_sensor_get_info(&sensor->id) : NULL;
+	if (!sensor_info) {
+		return ST_CAMERA_INITIALIZATION_FAILED;
+	}
+
+	info->model = sensor_info->model;
+	info->pid = sensor_info->pid;
+	info->name = sensor_info->name;
+	info->max_framesize = sensor_info->max_size < config.frame_size ? sensor_info->max_size : config.frame_size;
+	info->support_jpeg = sensor_info->support_jpeg;
+
 	return ST_SUCCESS;
 }
+
+static int base_quality = JPEG_QUALITY;
+static throttle_state_t throttle_state = THROTTLE_NONE;	// what backpressure asks for
+static volatile throttle_state_t link_throttle_state = THROTTLE_NONE;	// what the radio link asks for
+static throttle_state_t applied_throttle_state = THROTTLE_NONE;
+static int lagging_frames;
+static int keeping_up_frames;
+
+status_t camera_validate_sensor_control(const sensor_control_t* control) {
+	if (control->setting >= NUM_SENSOR_SETTINGS) {
+		return ST_SENSOR_CONTROL_INVALID;
+	}
+
+	const sensor_control_range_t* range = &sensor_control_ranges[control->setting];
+	if (control->value < range->min || control->value > range->max) {
+		return ST_SENSOR_CONTROL_INVALID;
+	}
+
+	// Frame buffers are sized for the initial frame size, larger frames would not fit
+	if (control->setting == SENSOR_FRAMESIZE && control->value > config.frame_size) {
+		return ST_SENSOR_CONTROL_INVALID;
+	}
+
+	return ST_SUCCESS;
+}
+
+// Higher values mean stronger compression, so the throttle adds its step up to the largest value
+static int get_throttled_quality(int quality, throttle_state_t state) {
+	if (state < THROTTLE_QUALITY) {
+		return quality;
+	}
+
+	quality += CONFIG_BACKPRESSURE_QUALITY_STEP;
+	return quality > JPEG_QUALITY_MAX ? JPEG_QUALITY_MAX : quality;
+}
+
+static int apply_sensor_control(sensor_t* sensor, const sensor_control_t* control) {
+	int value = control->value;
+	switch (control->setting) {
+		case SENSOR_QUALITY:
+			// The throttle works relative to the requested quality
+			base_quality = value;
+			return sensor->set_quality(sensor, get_throttled_quality(value, applied_throttle_state));
+		case SENSOR_FRAMESIZE:
+			framesize_reduced |= value < config.frame_size;
+			return sensor->set_framesize(sensor, (framesize_t)value);
+		case SENSOR_BRIGHTNESS: return sensor->set_brightness(sensor, value);
+		case SENSOR_CONTRAST: return sensor->set_contrast(sensor, value);
+		case SENSOR_SATURATION: return sensor->set_saturation(sensor, value);
+		case SENSOR_SHARPNESS: return sensor->set_sharpness(sensor, value);
+		case SENSOR_WHITEBAL: return sensor->set_whitebal(sensor, value);
+		case SENSOR_AWB_GAIN: return sensor->set_awb_gain(sensor, value);
+		case SENSOR_WB_MODE: return sensor->set_wb_mode(sensor, value);
+		case SENSOR_EXPOSURE_CTRL: return sensor->set_exposure_ctrl(sensor, value);
+		case SENSOR_AEC2: return sensor->set_aec2(sensor, value);
+		case SENSOR_AE_LEVEL: return sensor->set_ae_level(sensor, value);
+		case SENSOR_AEC_VALUE: return sensor->set_aec_value(sensor, value);
+		case SENSOR_GAIN_CTRL: return sensor->set_gain_ctrl(sensor, value);
+		case SENSOR_AGC_GAIN: return sensor->set_agc_gain(sensor, value);
+		case SENSOR_GAINCEILING: return sensor->set_gainceiling(sensor, (gainceiling_t)value);
+		case SENSOR_HMIRROR: return sensor->set_hmirror(sensor, value);
+		case SENSOR_VFLIP: return sensor->set_vflip(sensor, value);
+		case SENSOR_SPECIAL_EFFECT: return sensor->set_special_effect(sensor, value);
+		default: return -1;
+	}
+}
+
+void camera_apply_sensor_controls(const sensor_control_batch_t* batch) {
+	sensor_t* sensor = esp_camera_sensor_get();
+	if (!sensor) {
+		return;
+	}
+
+	for (int i = 0; i < batch->num_controls; ++i) {
+		const sensor_control_t* control = &batch->controls[i];
+		if (apply_sensor_control(sensor, control) != 0) {
+			ESP_LOGW(TAG, "Sensor rejected setting %u = %d", control->setting, control->value);
+		}
+	}
+}
+
+static void apply_throttle(sensor_t* sensor, throttle_state_t state) {
+	sensor->set_quality(sensor, get_throttled_quality(base_quality, state));
+
+	// Halving XCLK halves the sensor frame rate, so DMA and PSRAM stay idle instead of capturing frames nobody reads
+	if (sensor->set_xclk) {
+		int xclk_mhz = XCLK_FREQ_HZ / 1000000;
+		sensor->set_xclk(sensor, config.ledc_timer, state >= THROTTLE_FRAMERATE ? xclk_mhz / 2 : xclk_mhz);
+	}
+}
+
+void camera_set_link_throttle(throttle_state_t state) {
+	link_throttle_state = state;
+}
+
+throttle_state_t camera_update_throttle(bool consumers_lagging) {
+	if (consumers_lagging) {
+		lagging_frames += 1;
+		keeping_up_frames = 0;
+	} else {
+		keeping_up_frames += 1;
+		lagging_frames = 0;
+	}
+
+	if (lagging_frames >= CONFIG_BACKPRESSURE_LAG_THRESHOLD && throttle_state < THROTTLE_FRAMERATE) {
+		throttle_state += 1;
+		lagging_frames = 0;
+	} else if (keeping_up_frames >= CONFIG_BACKPRESSURE_RECOVERY_FRAMES && throttle_state > THROTTLE_NONE) {
+		throttle_state -= 1;
+		keeping_up_frames = 0;
+	}
+
+	// Both controllers share the one set of sensor knobs, the more cautious of the two wins
+	throttle_state_t link_state = link_throttle_state;
+	throttle_state_t new_state = throttle_state > link_state ? throttle_state : link_state;
+	if (new_state == applied_throttle_state) {
+		return applied_throttle_state;
+	}
+
+	sensor_t* sensor = esp_camera_sensor_get();
+	if (!sensor) {
+		return applied_throttle_state;
+	}
+
+	ESP_LOGI(TAG, "Throttle state %d -> %d (consumers %s, link %d)", applied_throttle_state, new_state,
+			consumers_lagging ? "lagging" : "caught up", link_state);
+	apply_throttle(sensor, new_state);
+	applied_throttle_state = new_state;
+
+	return applied_throttle_state;
+}
@@ -3,9 +3,75 @@
 
 #include "prelude.h"
 
-#define CAMERA_NUM_FRAMEBUFFERS 2
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CAMERA_NUM_FRAMEBUFFERS 2	// with the worst case buffer size, learned sizes may fit more
+#define CAMERA_MAX_FRAMEBUFFERS 3
+#define CAMERA_TARGET_FRAMERATE 30
+#define MAX_SENSOR_CONTROLS_PER_BATCH 16
+
+typedef enum {
+	THROTTLE_NONE = 0,
+	THROTTLE_QUALITY = 1,
+	THROTTLE_FRAMERATE = 2,
+} throttle_state_t;
+
+// Numbering is part of the control protocol
+typedef enum {
+	SENSOR_QUALITY = 0,
+	SENSOR_FRAMESIZE = 1,
+	SENSOR_BRIGHTNESS = 2,
+	SENSOR_CONTRAST = 3,
+	SENSOR_SATURATION = 4,
+	SENSOR_SHARPNESS = 5,
+	SENSOR_WHITEBAL = 6,
+	SENSOR_AWB_GAIN = 7,
+	SENSOR_WB_MODE = 8,
+	SENSOR_EXPOSURE_CTRL = 9,
+	SENSOR_AEC2 = 10,
+	SENSOR_AE_LEVEL = 11,
+	SENSOR_AEC_VALUE = 12,
+	SENSOR_GAIN_CTRL = 13,
+	SENSOR_AGC_GAIN = 14,
+	SENSOR_GAINCEILING = 15,
+	SENSOR_HMIRROR = 16,
+	SENSOR_VFLIP = 17,
+	SENSOR_SPECIAL_EFFECT = 18,
+	NUM_SENSOR_SETTINGS,
+} sensor_setting_t;
+
+typedef struct {
+	uint8_t setting;
+	int16_t value;
+} sensor_control_t;
+
+// Controls of one batch are applied together, between two captured frames
+typedef struct {
+	uint8_t num_controls;
+	sensor_control_t controls[MAX_SENSOR_CONTROLS_PER_BATCH];
+} sensor_control_batch_t;
+
+typedef struct {
+	uint8_t model;
+	uint16_t pid;
+	const char* name;
+	uint8_t max_framesize;	// largest frame size that fits the allocated frame buffers
+	bool support_jpeg;
+} camera_info_t;
 
 status_t camera_init();
+status_t camera_get_info(camera_info_t* info);
+// Stores the driver's frame buffer size suggestion for the next boot once it has settled
+void camera_persist_fb_size();
+
+status_t camera_validate_sensor_control(const sensor_control_t* control);
+void camera_apply_sensor_controls(const sensor_control_batch_t* batch);
+
+// Only records the request, the capture task applies it on its next camera_update_throttle
+void camera_set_link_throttle(throttle_state_t state);
+throttle_state_t camera_update_throttle(bool consumers_lagging);
 
 #endif
 
@@ -0,0 +1,134 @@
+#include "history.h"
+
+#include <stdlib.h>
+
+#include <esp_camera_arena.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#define TAG "history"
+
+#if CONFIG_FRAME_HISTORY
+
+#define WINDOW_US ((int64_t)CONFIG_FRAME_HISTORY_SECONDS * 1000000)
+#define BUFFER_SIZE (CONFIG_FRAME_HISTORY_SIZE_KB * 1024)
+#define MAX_FRAMES CONFIG_FRAME_HISTORY_MAX_FRAMES
+
+// Frames in capture order; their timestamps are indexed by the arena's block ids
+static esp_camera_arena_t* arena;
+static int64_t* timestamps;
+static SemaphoreHandle_t mutex;
+static uint32_t skipped_frames;
+
+static int64_t timestamp_at(size_t index) {
+	return timestamps[esp_camera_arena_block(arena, index)];
+}
+
+status_t history_init() {
+	arena = esp_camera_arena_create(BUFFER_SIZE, MAX_FRAMES, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+	timestamps = heap_caps_malloc(MAX_FRAMES * sizeof(int64_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+	mutex = xSemaphoreCreateMutex();
+	if (!arena || !timestamps || !mutex) {
+		ESP_LOGE(TAG, "Failed to allocate %d KB for the frame history", CONFIG_FRAME_HISTORY_SIZE_KB);
+		esp_camera_arena_delete(arena);
+		free(timestamps);
+		if (mutex) {
+			vSemaphoreDelete(mutex);
+		}
+		arena = NULL;
+		timestamps = NULL;
+		mutex = NULL;
+		return ST_HISTORY_INITIALIZATION_FAILED;
+	}
+
+	ESP_LOGI(TAG, "Keeping up to %d s or %d KB of frames", CONFIG_FRAME_HISTORY_SECONDS, CONFIG_FRAME_HISTORY_SIZE_KB);
+	return ST_SUCCESS;
+}
+
+void history_append(const uint8_t* buf, size_t len, int64_t timestamp_us) {
+	if (!arena || !len || len > BUFFER_SIZE) {
+		return;
+	}
+
+	// A reader holds the history, dropping this frame is better than stalling the pipeline
+	if (pdTRUE != xSemaphoreTake(mutex, 0)) {
+		if (++skipped_frames % 100 == 1) {
+			ESP_LOGW(TAG, "%u frames not recorded while the history was read", skipped_frames);
+		}
+		return;
+	}
+
+	// Range queries rely on timestamps growing
+	size_t count = esp_camera_arena_count(arena);
+	if (count && timestamp_at(count - 1) >= timestamp_us) {
+		xSemaphoreGive(mutex);
+		return;
+	}
+
+	while (esp_camera_arena_count(arena) && timestamp_at(0) < timestamp_us - WINDOW_US) {
+		esp_camera_arena_pop(arena);
+	}
+
+	// Frames are dropped oldest first, so an empty arena always has room for one that fits the buffer
+	int block;
+	while ((block = esp_camera_arena_push(arena, buf, len)) < 0) {
+		esp_camera_arena_pop(arena);
+	}
+	timestamps[block] = timestamp_us;
+
+	xSemaphoreGive(mutex);
+}
+
+size_t history_for_each(int64_t from_us, int64_t to_us, history_visitor_t visitor, void* context) {
+	if (!arena) {
+		return 0;
+	}
+
+	xSemaphoreTake(mutex, portMAX_DELAY);
+
+	size_t count = esp_camera_arena_count(arena);
+	size_t low = 0;
+	size_t high = count;
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		if (timestamp_at(middle) < from_us) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	size_t visited = 0;
+	for (size_t i = low; i < count && timestamp_at(i) <= to_us; ++i) {
+		int block = esp_camera_arena_block(arena, i);
+		history_frame_t frame = {
+			.buf = esp_camera_arena_data(arena, block),
+			.len = esp_camera_arena_len(arena, block),
+			.timestamp_us = timestamps[block],
+		};
+		++visited;
+		if (!visitor(&frame, context)) {
+			break;
+		}
+	}
+
+	xSemaphoreGive(mutex);
+	return visited;
+}
+
+#else
+
+status_t history_init() {
+	return ST_SUCCESS;
+}
+
+void history_append(const uint8_t* buf, size_t len, int64_t timestamp_us) {
+}
+
+size_t history_for_each(int64_t from_us, int64_t to_us, history_visitor_t visitor, void* context) {
+	return 0;
+}
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "prelude.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+	const uint8_t* buf;
+	size_t len;
+	int64_t timestamp_us;	// VSYNC time of the frame, esp_timer clock
+} history_frame_t;
+
+// Return false to stop the iteration
+typedef bool (*history_visitor_t)(const history_frame_t* frame, void* context);
+
+status_t history_init();
+// Keeps a copy of the frame and evicts frames that fell out of the time window or are in the way
+void history_append(const uint8_t* buf, size_t len, int64_t timestamp_us);
+// Visits the frames taken between from_us and to_us, oldest first. Frames appended meanwhile are
+// not recorded, so visitors should not block for long. Returns the number of frames visited.
+size_t history_for_each(int64_t from_us, int64_t to_us, history_visitor_t visitor, void* context);
+
+#endif
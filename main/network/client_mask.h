@@ -0,0 +1,20 @@
+#ifndef CLIENT_MASK_H
+#define CLIENT_MASK_H
+
+#include <stdint.h>
+
+// One bit per connection slot
+typedef uint64_t client_mask_t;
+
+#define CLIENT_MASK_CAPACITY 64
+#define CLIENT_MASK(client_index) ((client_mask_t)1 << (client_index))
+
+// Removes the lowest set client from the mask and returns its index; the mask must not be empty.
+// Iterating with it costs one step per set bit, however many slots there are.
+static inline int client_mask_pop(client_mask_t* mask) {
+	int client_index = __builtin_ctzll(*mask);
+	*mask &= *mask - 1;
+	return client_index;
+}
+
+#endif
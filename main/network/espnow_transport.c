@@ -0,0 +1,159 @@
+#include "espnow_transport.h"
+
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_now.h>
+#include <esp_wifi.h>
+#include <espnow_stream.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TAG "espnow"
+
+// About 15 KB still queued means the previous frame is far from out
+#define MAX_PACKETS_IN_FLIGHT 64
+
+#if CONFIG_ESPNOW_TRANSPORT
+
+typedef struct {
+	uint8_t* data;
+	size_t capacity;
+	size_t length;
+} frame_copy_t;
+
+static uint8_t peer_mac[ESP_NOW_ETH_ALEN];
+static espnow_stream_tx_t stream;
+static bool is_started;
+
+// A one frame slot where the newest frame replaces one not picked up yet; the sender swaps it
+// with its own copy, so neither side waits for the other for longer than a memcpy
+static frame_copy_t pending;
+static frame_copy_t sending;
+static SemaphoreHandle_t slot_mutex;
+static SemaphoreHandle_t frame_ready;
+
+status_t espnow_transport_start() {
+	if (ESP_NOW_ETH_ALEN != sscanf(CONFIG_ESPNOW_PEER_MAC, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+				&peer_mac[0], &peer_mac[1], &peer_mac[2], &peer_mac[3], &peer_mac[4], &peer_mac[5])) {
+		ESP_LOGE(TAG, "Invalid peer MAC address '%s'", CONFIG_ESPNOW_PEER_MAC);
+		return ST_SERVER_INITIALIZATION_FAILED;
+	}
+
+	slot_mutex = xSemaphoreCreateMutex();
+	frame_ready = xSemaphoreCreateBinary();
+	if (!slot_mutex || !frame_ready) {
+		ESP_LOGE(TAG, "Failed to create the frame slot");
+		return ST_SERVER_INITIALIZATION_FAILED;
+	}
+
+	esp_err_t error = esp_now_init();
+	if (!error) {
+		error = espnow_stream_esp_start_tx();
+	}
+
+	if (!error) {
+		// Channel 0 follows the station, which stays on the AP's channel
+		esp_now_peer_info_t peer = {
+			.channel = 0,
+			.ifidx = WIFI_IF_STA,
+			.encrypt = false,
+		};
+		memcpy(peer.peer_addr, peer_mac, sizeof(peer_mac));
+		error = esp_now_add_peer(&peer);
+	}
+
+	if (error) {
+		ESP_LOGE(TAG, "ESP-NOW initialization failed %s (0x%x)", get_error_name(error), error);
+		return ST_SERVER_INITIALIZATION_FAILED;
+	}
+
+	espnow_stream_tx_init(&stream, espnow_stream_esp_send, peer_mac);
+	is_started = true;
+	ESP_LOGI(TAG, "Streaming to %s", CONFIG_ESPNOW_PEER_MAC);
+
+	return ST_SUCCESS;
+}
+
+// Copies only ever grow, so allocations stop once the largest frames have been seen
+static bool reserve(frame_copy_t* copy, size_t length) {
+	if (copy->capacity >= length) {
+		return true;
+	}
+
+	uint8_t* data = heap_caps_realloc(copy->data, length, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+	if (!data) {
+		data = heap_caps_realloc(copy->data, length, MALLOC_CAP_8BIT);
+	}
+	if (!data) {
+		return false;
+	}
+
+	copy->data = data;
+	copy->capacity = length;
+	return true;
+}
+
+void espnow_transport_queue_frame(const uint8_t* frame, size_t length) {
+	if (!is_started) {
+		return;
+	}
+
+	xSemaphoreTake(slot_mutex, portMAX_DELAY);
+	bool is_queued = reserve(&pending, length);
+	if (is_queued) {
+		memcpy(pending.data, frame, length);
+		pending.length = length;
+	}
+	xSemaphoreGive(slot_mutex);
+
+	if (is_queued) {
+		xSemaphoreGive(frame_ready);
+	} else {
+		ESP_LOGD(TAG, "No memory to queue a frame of %u bytes", length);
+	}
+}
+
+void task_send_espnow_frames(void* params) {
+	while (1) {
+		xSemaphoreTake(frame_ready, portMAX_DELAY);
+
+		// A frame with missing fragments is useless to the peer, so the queued frame is only
+		// picked up once the previous one is out; frames queued meanwhile replace each other
+		while (espnow_stream_esp_in_flight() > MAX_PACKETS_IN_FLIGHT) {
+			vTaskDelay(1);
+		}
+
+		xSemaphoreTake(slot_mutex, portMAX_DELAY);
+		frame_copy_t next = pending;
+		pending = sending;
+		pending.length = 0;
+		sending = next;
+		xSemaphoreGive(slot_mutex);
+
+		if (!sending.length) {
+			continue;
+		}
+
+		esp_err_t error = espnow_stream_send_frame(&stream, sending.data, sending.length);
+		if (error) {
+			ESP_LOGD(TAG, "Frame of %u bytes not sent %s", sending.length, get_error_name(error));
+		}
+	}
+}
+
+#else
+
+status_t espnow_transport_start() {
+	return ST_SUCCESS;
+}
+
+void espnow_transport_queue_frame(const uint8_t* frame, size_t length) {
+}
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef ESPNOW_TRANSPORT_H
+#define ESPNOW_TRANSPORT_H
+
+#include "prelude.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+status_t espnow_transport_start();
+// Copies the frame for the ESP-NOW sender, replacing a queued frame it has not picked up yet
+void espnow_transport_queue_frame(const uint8_t* frame, size_t length);
+void task_send_espnow_frames(void* params);
+
+#endif
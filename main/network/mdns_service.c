@@ -0,0 +1,90 @@
+#include "mdns_service.h"
+#include "server.h"
+#include "camera/camera.h"
+
+#include <esp_camera.h>
+#include <esp_log.h>
+#include <mdns.h>
+
+#include <stdio.h>
+
+#define TAG "mdns"
+
+#define SERVICE_TYPE "_esp32eye"
+#define SERVICE_PROTOCOL "_tcp"
+
+#if CONFIG_MDNS_ADVERTISE
+
+static int advertised_clients = -1;
+static int advertised_streaming = -1;
+
+status_t mdns_service_start() {
+	esp_err_t error = mdns_init();
+	if (error) {
+		ESP_LOGE(TAG, "mDNS initialization failed %s (0x%x)", get_error_name(error), error);
+		return ST_SERVER_INITIALIZATION_FAILED;
+	}
+
+	mdns_hostname_set(CONFIG_MDNS_HOSTNAME);
+	mdns_instance_name_set(CONFIG_DEVICE_NAME);
+
+	char resolution_text[12] = "";
+	camera_info_t camera_info;
+	if (camera_get_info(&camera_info) == ST_SUCCESS) {
+		snprintf(resolution_text, sizeof(resolution_text), "%ux%u",
+				resolution[camera_info.max_framesize].width, resolution[camera_info.max_framesize].height);
+	}
+
+	char fps_text[4];
+	snprintf(fps_text, sizeof(fps_text), "%d", CAMERA_TARGET_FRAMERATE);
+	char rtp_port_text[6];
+	snprintf(rtp_port_text, sizeof(rtp_port_text), "%d", RTP_PORT);
+
+	// Everything a client needs to pick a camera and connect, without waiting for a broadcast
+	mdns_txt_item_t txt[] = {
+		{ "res", resolution_text },
+		{ "fps", fps_text },
+		{ "rtp", rtp_port_text },
+		{ "clients", "0" },
+		{ "streaming", "0" },
+	};
+
+	error = mdns_service_add(CONFIG_DEVICE_NAME, SERVICE_TYPE, SERVICE_PROTOCOL, SERVER_PORT, txt, sizeof(txt) / sizeof(txt[0]));
+	if (error) {
+		ESP_LOGE(TAG, "Failed to advertise the service %s (0x%x)", get_error_name(error), error);
+		return ST_SERVER_INITIALIZATION_FAILED;
+	}
+
+	advertised_clients = 0;
+	advertised_streaming = 0;
+	ESP_LOGI(TAG, "Advertising %s.%s on %s.local", SERVICE_TYPE, SERVICE_PROTOCOL, CONFIG_MDNS_HOSTNAME);
+
+	return ST_SUCCESS;
+}
+
+void mdns_service_update_load(int num_clients, int num_streaming) {
+	// Every TXT change is announced on the network, so only actual changes are pushed
+	if (advertised_clients < 0 || (num_clients == advertised_clients && num_streaming == advertised_streaming)) {
+		return;
+	}
+
+	char value[4];
+	snprintf(value, sizeof(value), "%d", num_clients);
+	mdns_service_txt_item_set(SERVICE_TYPE, SERVICE_PROTOCOL, "clients", value);
+	snprintf(value, sizeof(value), "%d", num_streaming);
+	mdns_service_txt_item_set(SERVICE_TYPE, SERVICE_PROTOCOL, "streaming", value);
+
+	advertised_clients = num_clients;
+	advertised_streaming = num_streaming;
+}
+
+#else
+
+status_t mdns_service_start() {
+	return ST_SUCCESS;
+}
+
+void mdns_service_update_load(int num_clients, int num_streaming) {
+}
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef MDNS_SERVICE_H
+#define MDNS_SERVICE_H
+
+#include "prelude.h"
+
+status_t mdns_service_start();
+void mdns_service_update_load(int num_clients, int num_streaming);
+
+#endif
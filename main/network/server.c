@@ -1,25 +1,55 @@
 #include "server.h"
 #include "esp_log.h"
 #include "lwip/def.h"
+#include "app/trace.h"
+#include "camera/camera.h"
+
+#include <esp_camera.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <freertos/task.h>
 
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <unistd.h>
+#include <stddef.h>
 #include <string.h>
 #include <lwip/inet.h>
 
-#define SERVER_PORT 3452
-#define BROADCAST_PORT 45122
-
-#define RTP_PORT 45120
 #define RTP_JPEG_PAYLOAD 26
+#define RTP_EXTENSION_BIT (1 << 4)
+// Profile-specific identifier of the frame metadata header extension
+#define RTP_FRAME_METADATA_PROFILE 0xE5F0
+
+#define CONTROL_BUFFER_SIZE (MESSAGE_FRAME_HEADER_SIZE + MAX_REQUEST_BODY_SIZE)
+#define CONTROL_POLL_TIMEOUT_MS 1000
+#define CONTROL_SEND_TIMEOUT_MS 500
+#define ACCEPT_POLL_TIMEOUT_MS 500
+
+// Sockets the server keeps open besides the client control sockets
+#define SERVER_OWN_SOCKETS 3
+// Per-client DRAM outside of connections[]: lwIP PCB and netconn plus a full TCP send buffer
+#define CLIENT_DRAM_ESTIMATE (1024 + CONFIG_LWIP_TCP_SND_BUF_DEFAULT)
+// DRAM left for Wi-Fi, the camera driver and task stacks after all clients are connected
+#define DRAM_RESERVE (48 * 1024)
 
-#define MAX_REQUEST_SIZE 32
+_Static_assert(MAX_CONNECTIONS <= CLIENT_MASK_CAPACITY, "Client masks can't hold that many connections");
+
+#define HELLO_VERSION 1
+#define HELLO_DEVICE_NAME_SIZE 32
+#define HELLO_MAX_PROFILES 16
+#define HELLO_MAX_SIZE 192
 
 #define TAG "server"
 
 typedef enum {
 	MESSAGE_BROADCAST = 0xAABB1234,
+	MESSAGE_DISCOVERY_PROBE = 0xAABB1235,
 	MESSAGE_HELLO = 0xCABFEEFD,
+	MESSAGE_TELEMETRY = 0xCABFEEFE,
+	MESSAGE_LATENCY = 0xCABFEEFF,
+	MESSAGE_TRACE = 0xCABFEF00,
+	MESSAGE_HEARTBEAT = 0xCABFEF01,
 } message_header_t;
 
 typedef struct {
@@ -31,28 +61,131 @@ typedef struct {
 	uint32_t payload_length;
 } rtp_header_t;
 
+// Follows rtp_header_t when the extension bit is set, for clients that asked for frame metadata
+typedef struct {
+	uint16_t profile;
+	uint16_t length;	// in 32 bit words, without profile and length
+	uint32_t frame_sequence;
+	uint16_t dropped_frames;
+	int16_t agc_gain;
+	int32_t aec_value;
+	uint32_t dma_us;
+} __attribute__((packed)) rtp_frame_metadata_t;
+
 struct client_connection{
-	bool is_active;
 	int control_socket;
 	char address_string[20];
 	struct sockaddr_in rtp_address;
+	uint8_t control_buffer[CONTROL_BUFFER_SIZE];	// bytes of a partially received request
+	size_t control_buffer_length;
+	uint8_t missed_heartbeats;	// heartbeats sent since the client was last heard from
+	uint32_t min_frame_interval_us;	// from the client's preferred frame rate, 0 if unlimited
+	int64_t last_frame_sent_at;
 };
 
+#define ANNOUNCE_VERSION 1
+
+// Sent as the discovery broadcast and as the reply to probes; the header stays first for older clients
 typedef struct {
+	uint32_t header;
+	uint8_t version;
+	uint8_t num_clients;
+	uint8_t max_clients;
+	uint8_t num_streaming;
+	uint16_t control_port;
+	uint8_t throttle_state;
+	uint8_t max_framesize;
+	uint16_t max_width;
+	uint16_t max_height;
+	uint8_t max_fps;
+	uint8_t reserved;
 	char device_name[32];
-} hello_message_t;
+} __attribute__((packed)) announce_message_t;
+
+// Hello TLV types; clients skip the ones they don't know
+typedef enum {
+	HELLO_TLV_SENSOR = 1,		// u8 model, u16 PID, u8 max frame size, u8 JPEG support, sensor name
+	HELLO_TLV_PROFILES = 2,		// [u8 frame size][u16 width][u16 height] per supported frame size
+	HELLO_TLV_TRANSPORTS = 3,	// u8 transport_t bitmask
+	HELLO_TLV_MAX_FPS = 4,		// u8
+	HELLO_TLV_FEATURES = 5,		// u32 hello_feature_t bitmask
+} hello_tlv_type_t;
+
+typedef enum {
+	TRANSPORT_RTP_UDP = 1 << 0,
+	TRANSPORT_ESPNOW = 1 << 1,	// frames also go to one fixed ESP-NOW peer
+} transport_t;
+
+typedef enum {
+	FEATURE_TELEMETRY = 1 << 0,
+	FEATURE_LATENCY = 1 << 1,
+	FEATURE_TRACE = 1 << 2,
+	FEATURE_SENSOR_CONTROL = 1 << 3,
+	FEATURE_HEARTBEAT = 1 << 4,
+	FEATURE_CLIENT_PREFERENCES = 1 << 5,
+	FEATURE_FRAME_METADATA = 1 << 6,
+} hello_feature_t;
+
+typedef struct {
+	uint32_t uptime_ms;
+	uint32_t frames_captured;
+	uint32_t frames_skipped;
+	uint32_t throttle_transitions;
+	uint16_t consumer_lag;
+	uint8_t throttle_state;
+	uint8_t num_clients;
+	uint32_t wifi_reconnects;
+	uint32_t last_reconnect_ms;
+	int8_t rssi;
+	uint8_t link_level;
+	uint32_t camera_no_soi;
+	uint32_t camera_no_eoi;
+	uint32_t camera_fb_overflows;
+	uint32_t camera_queue_drops;
+} __attribute__((packed)) telemetry_message_t;
+
+typedef struct {
+	uint8_t num_stages;
+	uint8_t num_buckets;
+	uint8_t bucket_base_shift;
+	uint8_t reserved;
+	struct {
+		uint32_t max_us;
+		uint32_t buckets[LATENCY_NUM_BUCKETS];
+	} stages[NUM_LATENCY_STAGES];
+} latency_message_t;
+
+typedef struct {
+	uint8_t core;
+	uint8_t is_last;
+	uint16_t num_events;
+	trace_event_t events[TRACE_CHUNK_MAX_EVENTS];
+} trace_message_t;
 
 static int server_socket;
+static volatile bool server_socket_stale;
 static int rtp_socket;
 static int broadcast_socket;
 static int num_active_connections = 0;
+static SemaphoreHandle_t control_send_mutex;
 static uint32_t rtp_ssid;
-static uint16_t video_interest_mask;
-static uint8_t recv_buffer[MAX_REQUEST_SIZE * MAX_CONNECTIONS];
+static client_mask_t active_mask;
+static client_mask_t video_interest_mask;
+static client_mask_t frame_metadata_mask;
+static int connection_limit = MAX_CONNECTIONS;
 static client_connection_t connections[MAX_CONNECTIONS] = {0};
+// Bumped whenever a slot's control socket is closed, so a reply copied out before that is not sent
+// to whichever client got the descriptor number next
+static uint32_t connection_generations[MAX_CONNECTIONS];
+
+typedef struct {
+	int client_index;
+	int socket;
+	uint32_t generation;
+} control_socket_t;
 
 static bool is_active_client(int client_index) {
-	return client_index >= 0 && client_index < MAX_CONNECTIONS && connections[client_index].is_active;
+	return client_index >= 0 && client_index < MAX_CONNECTIONS && (active_mask & CLIENT_MASK(client_index));
 }
 
 static void server_disconnect_client_no_sync(int client_index) {
@@ -60,42 +193,166 @@ static void server_disconnect_client_no_sync(int client_index) {
 		return;
 	}
 
+	xSemaphoreTake(control_send_mutex, portMAX_DELAY);
+	connection_generations[client_index] += 1;
+	close(connections[client_index].control_socket);
+	xSemaphoreGive(control_send_mutex);
 	memset(&connections[client_index], 0, sizeof(client_connection_t));
-	video_interest_mask &= ~(1 << client_index);
+	active_mask &= ~CLIENT_MASK(client_index);
+	video_interest_mask &= ~CLIENT_MASK(client_index);
+	frame_metadata_mask &= ~CLIENT_MASK(client_index);
 	num_active_connections -= 1;
 	ESP_LOGI(TAG, "Client %d disconnected. Currently active connections: %d", client_index, num_active_connections);
 
 }
 
+static bool send_control_message_no_sync(int socket, message_header_t header, const void* body, size_t body_length) {
+	uint8_t frame_header[MESSAGE_FRAME_HEADER_SIZE] = {
+		header >> 24, header >> 16, header >> 8, header,
+		body_length >> 8, body_length,
+	};
+
+	struct iovec iovs[2];
+	iovs[0].iov_base = frame_header;
+	iovs[0].iov_len = sizeof(frame_header);
+	iovs[1].iov_base = (void*)body;
+	iovs[1].iov_len = body_length;
+
+	struct msghdr message = {0};
+	message.msg_iov = iovs;
+	message.msg_iovlen = 2;
+
+	return sendmsg(socket, &message, 0) >= 0;
+}
+
+// Several tasks reply on the control sockets; a message must not be interleaved with another one
+static bool send_control_message(int socket, message_header_t header, const void* body, size_t body_length) {
+	xSemaphoreTake(control_send_mutex, portMAX_DELAY);
+	bool is_sent = send_control_message_no_sync(socket, header, body, body_length);
+	xSemaphoreGive(control_send_mutex);
+
+	return is_sent;
+}
+
+// The client may have been disconnected since its socket was looked up; the descriptor is only
+// closed under the send mutex, so checking the generation there is enough
+static bool send_client_message(const control_socket_t* target, message_header_t header, const void* body, size_t body_length) {
+	xSemaphoreTake(control_send_mutex, portMAX_DELAY);
+	bool is_current = connection_generations[target->client_index] == target->generation;
+	bool is_sent = is_current && send_control_message_no_sync(target->socket, header, body, body_length);
+	xSemaphoreGive(control_send_mutex);
+
+	return is_sent;
+}
+
+static void configure_control_socket(int client_socket) {
+	// Catches clients that vanished without a FIN even when no heartbeat is due
+	int keepalive = 1;
+	int keepalive_idle_s = CONFIG_CLIENT_KEEPALIVE_IDLE_S;
+	int keepalive_interval_s = CONFIG_CLIENT_KEEPALIVE_INTERVAL_S;
+	int keepalive_count = CONFIG_CLIENT_KEEPALIVE_COUNT;
+	setsockopt(client_socket, SOL_SOCKET, SO_KEEPALIVE, &keepalive, sizeof(keepalive));
+	setsockopt(client_socket, IPPROTO_TCP, TCP_KEEPIDLE, &keepalive_idle_s, sizeof(keepalive_idle_s));
+	setsockopt(client_socket, IPPROTO_TCP, TCP_KEEPINTVL, &keepalive_interval_s, sizeof(keepalive_interval_s));
+	setsockopt(client_socket, IPPROTO_TCP, TCP_KEEPCNT, &keepalive_count, sizeof(keepalive_count));
+
+	// A full send buffer of a dead client must not block the tasks replying to everyone else
+	struct timeval send_timeout = { .tv_sec = 0, .tv_usec = CONTROL_SEND_TIMEOUT_MS * 1000 };
+	setsockopt(client_socket, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+}
+
+static status_t open_datagram_sockets();
+static status_t open_server_socket();
+
+// Lowers the connection limit to what the socket pool and free DRAM can actually hold
+static void check_connection_budget() {
+	int socket_limit = CONFIG_LWIP_MAX_SOCKETS - SERVER_OWN_SOCKETS;
+	if (connection_limit > socket_limit) {
+		ESP_LOGW(TAG, "Only %d lwIP sockets are configured, limiting clients to %d", CONFIG_LWIP_MAX_SOCKETS, socket_limit);
+		connection_limit = socket_limit;
+	}
+
+	size_t free_dram = heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+	int dram_limit = free_dram > DRAM_RESERVE ? (free_dram - DRAM_RESERVE) / CLIENT_DRAM_ESTIMATE : 0;
+	if (connection_limit > dram_limit) {
+		ESP_LOGW(TAG, "%zu bytes of free DRAM fit only %d clients", free_dram, dram_limit);
+		connection_limit = dram_limit;
+	}
+
+	ESP_LOGI(TAG, "Accepting up to %d clients (%d configured), registry takes %zu bytes",
+			connection_limit, MAX_CONNECTIONS, sizeof(connections));
+}
 
 status_t server_start() {
+	check_connection_budget();
+
+	control_send_mutex = xSemaphoreCreateMutex();
+	if (!control_send_mutex) {
+		ESP_LOGE(TAG, "Failed to create control socket mutex");
+		return ST_SERVER_INITIALIZATION_FAILED;
+	}
+
+	rtp_ssid = esp_random();
+
+	status_t status = open_datagram_sockets();
+	if (status == ST_SUCCESS) {
+		status = open_server_socket();
+	}
+
+	if (status == ST_SUCCESS) {
+		ESP_LOGI(TAG, "Server started listening on port %d", SERVER_PORT);
+	}
+
+	return status;
+}
+
+static status_t open_datagram_sockets() {
 	rtp_socket = socket(AF_INET, SOCK_DGRAM, 0);
-	if (!rtp_socket) {
+	if (rtp_socket < 0) {
         ESP_LOGE(TAG, "RTP socket creation failed");
         return ST_SERVER_INITIALIZATION_FAILED;
 	}
 
-	rtp_ssid = esp_random();
-
 	broadcast_socket = socket(AF_INET, SOCK_DGRAM, 0);
 	if (broadcast_socket < 0) {
 		ESP_LOGE(TAG, "Failed to create broadcast socket");
+		close(rtp_socket);
 		return ST_SERVER_INITIALIZATION_FAILED;
 	}
 
 	int broadcast = 1;
 	if (setsockopt(broadcast_socket, SOL_SOCKET, SO_BROADCAST, &broadcast, sizeof(broadcast)) < 0) {
 		ESP_LOGE(TAG, "Failed to obtain broadcasting permissions");
+		close(broadcast_socket);
+		close(rtp_socket);
+		return ST_SERVER_INITIALIZATION_FAILED;
+	}
+
+	// Clients probe the broadcast port, so the same socket receives the probes
+	struct sockaddr_in discovery_address = {0};
+	discovery_address.sin_family = AF_INET;
+	discovery_address.sin_addr.s_addr = htonl(INADDR_ANY);
+	discovery_address.sin_port = htons(BROADCAST_PORT);
+	if (bind(broadcast_socket, (struct sockaddr*)&discovery_address, sizeof(discovery_address)) < 0) {
+		ESP_LOGE(TAG, "Failed to bind the discovery socket");
+		close(broadcast_socket);
+		close(rtp_socket);
 		return ST_SERVER_INITIALIZATION_FAILED;
 	}
 
+	return ST_SUCCESS;
+}
+
+static status_t open_server_socket() {
     server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (!server_socket) {
+    if (server_socket < 0) {
         ESP_LOGE(TAG, "Server socket creation failed");
         return ST_SERVER_INITIALIZATION_FAILED;
     }
 
-    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, NULL, 0);
+    // Needed to bind the port again when the sockets are rebuilt after an IP change
+    int reuse = 1;
+    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 
     struct sockaddr_in address;
     address.sin_family = AF_INET;
@@ -104,27 +361,121 @@ status_t server_start() {
 
     if (bind(server_socket, (struct sockaddr*)&address, sizeof(address)) < 0) {
         ESP_LOGE(TAG, "Server socket bind failed");
+        close(server_socket);
         return ST_SERVER_INITIALIZATION_FAILED;
     }
 
-    if (listen(server_socket, MAX_CONNECTIONS) < 0) {
+    if (listen(server_socket, connection_limit) < 0) {
         ESP_LOGE(TAG, "Server socket listening failed");
+        close(server_socket);
         return ST_SERVER_INITIALIZATION_FAILED;
     }
 
-    ESP_LOGI(TAG, "Server started listening on port %d", SERVER_PORT);
-
     return ST_SUCCESS;
 }
 
-int server_accept_connections(SemaphoreHandle_t semaphore) {
+status_t server_reopen_sockets(SemaphoreHandle_t semaphore) {
 	xSemaphoreTake(semaphore, portMAX_DELAY);
-	if (num_active_connections >= MAX_CONNECTIONS) {
-		xSemaphoreGive(semaphore);
-		return -1;
+	// Control connections were bound to the old address and are dead; clients reconnect after discovery
+	for (client_mask_t clients = active_mask; clients;) {
+		server_disconnect_client_no_sync(client_mask_pop(&clients));
 	}
 
+	close(broadcast_socket);
+	close(rtp_socket);
+	status_t status = open_datagram_sockets();
+	// The accept task may be blocked on the listening socket, so it closes and reopens that one itself
+	server_socket_stale = true;
 	xSemaphoreGive(semaphore);
+
+	if (status == ST_SUCCESS) {
+		ESP_LOGI(TAG, "Sockets rebuilt for the new address");
+	}
+
+	return status;
+}
+
+static uint8_t* append_tlv(uint8_t* cursor, hello_tlv_type_t type, const void* value, uint8_t length) {
+	cursor[0] = type;
+	cursor[1] = length;
+	memcpy(&cursor[2], value, length);
+	return &cursor[2 + length];
+}
+
+// The device name stays at the front so clients from before the TLVs keep working
+static size_t build_hello_message(uint8_t buffer[HELLO_MAX_SIZE]) {
+	memset(buffer, 0, HELLO_DEVICE_NAME_SIZE);
+	strncpy((char*)buffer, CONFIG_DEVICE_NAME, HELLO_DEVICE_NAME_SIZE);
+	buffer[HELLO_DEVICE_NAME_SIZE] = HELLO_VERSION;
+	uint8_t* cursor = &buffer[HELLO_DEVICE_NAME_SIZE + 1];
+
+	camera_info_t camera_info;
+	if (camera_get_info(&camera_info) == ST_SUCCESS) {
+		uint8_t sensor[5 + 16];
+		size_t name_length = strnlen(camera_info.name, 16);
+		sensor[0] = camera_info.model;
+		sensor[1] = camera_info.pid >> 8;
+		sensor[2] = camera_info.pid;
+		sensor[3] = camera_info.max_framesize;
+		sensor[4] = camera_info.support_jpeg;
+		memcpy(&sensor[5], camera_info.name, name_length);
+		cursor = append_tlv(cursor, HELLO_TLV_SENSOR, sensor, 5 + name_length);
+
+		uint8_t profiles[HELLO_MAX_PROFILES * 5];
+		size_t num_profiles = camera_info.max_framesize + 1;
+		if (num_profiles > HELLO_MAX_PROFILES) {
+			num_profiles = HELLO_MAX_PROFILES;
+		}
+		for (size_t i = 0; i < num_profiles; ++i) {
+			uint8_t* profile = &profiles[i * 5];
+			profile[0] = i;
+			profile[1] = resolution[i].width >> 8;
+			profile[2] = resolution[i].width;
+			profile[3] = resolution[i].height >> 8;
+			profile[4] = resolution[i].height;
+		}
+		cursor = append_tlv(cursor, HELLO_TLV_PROFILES, profiles, num_profiles * 5);
+	}
+
+	uint8_t transports = TRANSPORT_RTP_UDP;
+#if CONFIG_ESPNOW_TRANSPORT
+	transports |= TRANSPORT_ESPNOW;
+#endif
+	cursor = append_tlv(cursor, HELLO_TLV_TRANSPORTS, &transports, sizeof(transports));
+
+	uint8_t max_fps = CAMERA_TARGET_FRAMERATE;
+	cursor = append_tlv(cursor, HELLO_TLV_MAX_FPS, &max_fps, sizeof(max_fps));
+
+	uint32_t features = htonl(FEATURE_TELEMETRY | FEATURE_LATENCY | FEATURE_TRACE | FEATURE_SENSOR_CONTROL |
+			FEATURE_HEARTBEAT | FEATURE_CLIENT_PREFERENCES | FEATURE_FRAME_METADATA);
+	cursor = append_tlv(cursor, HELLO_TLV_FEATURES, &features, sizeof(features));
+
+	return cursor - buffer;
+}
+
+// Waits for a connection in short polls so a socket rebuild is noticed without closing a socket under accept()
+static bool wait_for_connection() {
+	if (server_socket_stale) {
+		server_socket_stale = false;
+		if (server_socket >= 0) {
+			close(server_socket);
+		}
+		if (open_server_socket() != ST_SUCCESS) {
+			server_socket = -1;
+			server_socket_stale = true;
+			vTaskDelay(ACCEPT_POLL_TIMEOUT_MS / portTICK_PERIOD_MS);
+			return false;
+		}
+	}
+
+	struct pollfd fd = { .fd = server_socket, .events = POLLIN };
+	return poll(&fd, 1, ACCEPT_POLL_TIMEOUT_MS) > 0;
+}
+
+int server_accept_connections(SemaphoreHandle_t semaphore) {
+	while (!wait_for_connection()) {
+	}
+
 	struct sockaddr_in incoming_address;
 	int address_length = sizeof(incoming_address);
 	int client_socket = accept(server_socket, (struct sockaddr*) &incoming_address, (socklen_t*) &address_length);
@@ -133,32 +484,22 @@ int server_accept_connections(SemaphoreHandle_t semaphore) {
 		return -1;
 	}
 
-	hello_message_t hello_message = {0};
-	strncpy(hello_message.device_name, CONFIG_DEVICE_NAME, 32);
-	
-	uint32_t message_header = htonl(MESSAGE_HELLO);
-	struct iovec iovs[2];
-	iovs[0].iov_base = &message_header;
-	iovs[0].iov_len = sizeof(message_header);
-	iovs[1].iov_base = &hello_message;
-	iovs[1].iov_len = sizeof(hello_message);
-	
-	struct msghdr message = {0};
-	message.msg_iov = iovs;
-	message.msg_iovlen = 2;
-	
-	sendmsg(client_socket, &message, 0);
+	configure_control_socket(client_socket);
+
+	uint8_t hello_message[HELLO_MAX_SIZE];
+	size_t hello_length = build_hello_message(hello_message);
+	send_control_message(client_socket, MESSAGE_HELLO, hello_message, hello_length);
 
 	struct sockaddr_in rtp_address = incoming_address;
 	rtp_address.sin_port = htons(RTP_PORT);
 
 	xSemaphoreTake(semaphore, portMAX_DELAY);
-	for(int i = 0; i < MAX_CONNECTIONS; ++i) {
-		if (connections[i].is_active) {
-			continue;
-		}
-
-		connections[i].is_active = true;
+	// A client over the limit is accepted and closed right away rather than left waiting in the backlog
+	client_mask_t usable_slots = connection_limit >= CLIENT_MASK_CAPACITY ? ~(client_mask_t)0 : CLIENT_MASK(connection_limit) - 1;
+	client_mask_t free_slots = usable_slots & ~active_mask;
+	if (free_slots) {
+		int i = client_mask_pop(&free_slots);
+		active_mask |= CLIENT_MASK(i);
 		connections[i].control_socket = client_socket;
 		connections[i].rtp_address = rtp_address;
 		strcpy(connections[i].address_string, inet_ntoa(incoming_address.sin_addr));
@@ -172,33 +513,89 @@ int server_accept_connections(SemaphoreHandle_t semaphore) {
 	}
 
 	xSemaphoreGive(semaphore);
+	ESP_LOGW(TAG, "Rejecting client %s, all %d slots are taken", inet_ntoa(incoming_address.sin_addr), connection_limit);
+	close(client_socket);
 	return -1;
 }
 
+// Extracts complete requests from the connection buffer. Returns false if the client broke the framing.
+static bool parse_requests_no_sync(int client_index, request_t* requests, size_t* num_requests) {
+	client_connection_t* connection = &connections[client_index];
+	size_t offset = 0;
+
+	while (*num_requests < MAX_REQUESTS_PER_POLL && connection->control_buffer_length - offset >= MESSAGE_FRAME_HEADER_SIZE) {
+		uint8_t* frame = &connection->control_buffer[offset];
+		// Frames start at arbitrary offsets, so fields are assembled bytewise to avoid unaligned loads
+		uint16_t body_length = frame[4] << 8 | frame[5];
+		if (body_length > MAX_REQUEST_BODY_SIZE) {
+			ESP_LOGW(TAG, "Client %d sent a %u byte request, dropping the connection", client_index, body_length);
+			return false;
+		}
+
+		if (connection->control_buffer_length - offset < MESSAGE_FRAME_HEADER_SIZE + body_length) {
+			break;
+		}
+
+		request_t* request = &requests[(*num_requests)++];
+		request->client_index = client_index;
+		request->request_type = (uint32_t)frame[0] << 24 | frame[1] << 16 | frame[2] << 8 | frame[3];
+		request->request_body_length = body_length;
+		memcpy(request->request_body, &frame[MESSAGE_FRAME_HEADER_SIZE], body_length);
+
+		offset += MESSAGE_FRAME_HEADER_SIZE + body_length;
+	}
+
+	connection->control_buffer_length -= offset;
+	memmove(connection->control_buffer, &connection->control_buffer[offset], connection->control_buffer_length);
+	return true;
+}
+
 void server_handle_requests(request_t* requests, size_t* num_requests, SemaphoreHandle_t semaphore) {
+	size_t served_requests = 0;
 	struct pollfd fds[MAX_CONNECTIONS];
+	uint8_t fd_clients[MAX_CONNECTIONS];
+	int num_fds = 0;
+
 	xSemaphoreTake(semaphore, portMAX_DELAY);
-	for (int i = 0; i < MAX_CONNECTIONS; ++i) {
-		if (!connections[i].is_active) {
-			fds[i].fd = -1;
-		} else {
-			fds[i].fd = connections[i].control_socket;
-			fds[i].events = POLLIN;
+	// Requests left over when the previous call ran out of room go first, as poll won't report them again
+	for (client_mask_t clients = active_mask; clients;) {
+		int i = client_mask_pop(&clients);
+		if (!parse_requests_no_sync(i, requests, &served_requests)) {
+			server_disconnect_client_no_sync(i);
 		}
 	}
+
+	// Only active clients are polled, so an idle registry costs nothing however large it is
+	for (client_mask_t clients = active_mask; clients; ++num_fds) {
+		int i = client_mask_pop(&clients);
+		fds[num_fds].fd = connections[i].control_socket;
+		fds[num_fds].events = POLLIN;
+		fds[num_fds].revents = 0;
+		fd_clients[num_fds] = i;
+	}
 	xSemaphoreGive(semaphore);
 
-	poll(fds, MAX_CONNECTIONS, -1);
+	if (served_requests == MAX_REQUESTS_PER_POLL) {
+		*num_requests = served_requests;
+		return;
+	}
+
+	// A finite timeout lets the caller notice clients disconnected by other tasks
+	if (poll(fds, num_fds, served_requests ? 0 : CONTROL_POLL_TIMEOUT_MS) <= 0) {
+		*num_requests = served_requests;
+		return;
+	}
 
-	int served_requests = 0;
 	xSemaphoreTake(semaphore, portMAX_DELAY);
-	for (int i = 0; i < MAX_CONNECTIONS; ++i) {
-		if (!connections[i].is_active || !(fds[i].revents & POLLIN)) {
+	for (int fd = 0; fd < num_fds; ++fd) {
+		int i = fd_clients[fd];
+		if (!is_active_client(i) || connections[i].control_socket != fds[fd].fd || !(fds[fd].revents & POLLIN)) {
 			continue;
 		}
 
-		uint8_t* recv_buffer_chunk = &recv_buffer[i * MAX_REQUEST_SIZE];
-		ssize_t received_bytes = recv(fds[i].fd, recv_buffer_chunk, MAX_REQUEST_SIZE, 0);
+		client_connection_t* connection = &connections[i];
+		ssize_t received_bytes = recv(fds[fd].fd, &connection->control_buffer[connection->control_buffer_length],
+				CONTROL_BUFFER_SIZE - connection->control_buffer_length, 0);
 		if (received_bytes < 0) {
 			ESP_LOGE(TAG, "Failed to receive data from client %s", strerror(errno));
 			server_disconnect_client_no_sync(i);
@@ -210,48 +607,82 @@ void server_handle_requests(request_t* requests, size_t* num_requests, Semaphore
 			continue;
 		}
 
-		ESP_LOGI(TAG, "Received %zu bytes from %s", received_bytes, connections[i].address_string);
-		if (received_bytes < 4) {
-			continue;
+		TRACE_EVENT(TRACE_STAGE_REQUESTS, TRACE_REQUEST_RECEIVED, i, received_bytes);
+		connection->control_buffer_length += received_bytes;
+		connection->missed_heartbeats = 0;
+		if (!parse_requests_no_sync(i, requests, &served_requests)) {
+			server_disconnect_client_no_sync(i);
 		}
-
-		requests[served_requests].client_index = i;
-		requests[served_requests].request_type = ntohl(*(uint32_t*)recv_buffer_chunk);
-		requests[served_requests].request_body = &recv_buffer_chunk[sizeof(uint32_t)];
-		requests[served_requests].request_body_length = received_bytes - sizeof(uint32_t);
-		served_requests += 1;
 	}
 	xSemaphoreGive(semaphore);
 
 	*num_requests = served_requests;
 }
 
-uint16_t server_update_client_video_interest(int client_index, bool is_interested) {
+client_mask_t server_update_client_video_interest(int client_index, bool is_interested) {
 	if (!is_active_client(client_index)) {
 		return 0;
 	}
 
 	if (is_interested) {
-		video_interest_mask |= (1 << client_index);
+		video_interest_mask |= CLIENT_MASK(client_index);
 	} else {
-		video_interest_mask &= ~(1 << client_index);
+		video_interest_mask &= ~CLIENT_MASK(client_index);
 	}
 
 	return video_interest_mask;
 }
 
-uint16_t server_get_video_interest_sync(SemaphoreHandle_t semaphore) {
+client_mask_t server_get_active_clients_sync(SemaphoreHandle_t semaphore) {
+	xSemaphoreTake(semaphore, portMAX_DELAY);
+	client_mask_t clients = active_mask;
+	xSemaphoreGive(semaphore);
+
+	return clients;
+}
+
+client_mask_t server_get_video_interest_sync(SemaphoreHandle_t semaphore) {
 	xSemaphoreTake(semaphore, portMAX_DELAY);
-	uint16_t interest = server_get_video_interest();
+	client_mask_t interest = server_get_video_interest();
 	xSemaphoreGive(semaphore);
 
 	return interest;
 }
 
-uint16_t server_get_video_interest() {
+client_mask_t server_get_video_interest() {
 	return video_interest_mask;
 }
 
+bool server_set_client_max_framerate(int client_index, uint8_t max_fps, SemaphoreHandle_t semaphore) {
+	xSemaphoreTake(semaphore, portMAX_DELAY);
+	if (!is_active_client(client_index)) {
+		xSemaphoreGive(semaphore);
+		return false;
+	}
+
+	connections[client_index].min_frame_interval_us = max_fps ? 1000000 / max_fps : 0;
+	xSemaphoreGive(semaphore);
+
+	return true;
+}
+
+bool server_set_client_frame_metadata(int client_index, bool enabled, SemaphoreHandle_t semaphore) {
+	xSemaphoreTake(semaphore, portMAX_DELAY);
+	if (!is_active_client(client_index)) {
+		xSemaphoreGive(semaphore);
+		return false;
+	}
+
+	if (enabled) {
+		frame_metadata_mask |= CLIENT_MASK(client_index);
+	} else {
+		frame_metadata_mask &= ~CLIENT_MASK(client_index);
+	}
+	xSemaphoreGive(semaphore);
+
+	return true;
+}
+
 char* server_get_client_address(int client_index, SemaphoreHandle_t semaphore) {
 	xSemaphoreTake(semaphore, portMAX_DELAY);
 	if (!is_active_client(client_index)) {
@@ -277,16 +708,178 @@ int server_get_clients_count() {
 	return num_active_connections;
 }
 
-void server_send_broadcast() {
+static bool get_control_socket_no_sync(int client_index, control_socket_t* target) {
+	if (!is_active_client(client_index)) {
+		return false;
+	}
+
+	target->client_index = client_index;
+	target->socket = connections[client_index].control_socket;
+	target->generation = connection_generations[client_index];
+	return true;
+}
+
+static bool get_control_socket(int client_index, SemaphoreHandle_t semaphore, control_socket_t* target) {
+	xSemaphoreTake(semaphore, portMAX_DELAY);
+	bool is_active = get_control_socket_no_sync(client_index, target);
+	xSemaphoreGive(semaphore);
+
+	return is_active;
+}
+
+bool server_send_heartbeat(int client_index, SemaphoreHandle_t semaphore) {
+	xSemaphoreTake(semaphore, portMAX_DELAY);
+	if (!is_active_client(client_index)) {
+		xSemaphoreGive(semaphore);
+		return false;
+	}
+
+	client_connection_t* connection = &connections[client_index];
+	if (connection->missed_heartbeats >= CONFIG_HEARTBEAT_MAX_MISSED) {
+		ESP_LOGW(TAG, "Client %s missed %u heartbeats", connection->address_string, connection->missed_heartbeats);
+		xSemaphoreGive(semaphore);
+		return false;
+	}
+
+	connection->missed_heartbeats += 1;
+	control_socket_t control_socket;
+	get_control_socket_no_sync(client_index, &control_socket);
+	xSemaphoreGive(semaphore);
+
+	return send_client_message(&control_socket, MESSAGE_HEARTBEAT, NULL, 0);
+}
+
+bool server_send_telemetry(int client_index, const telemetry_t* telemetry, SemaphoreHandle_t semaphore) {
+	control_socket_t control_socket;
+	if (!get_control_socket(client_index, semaphore, &control_socket)) {
+		return false;
+	}
+
+	telemetry_message_t message = {
+		.uptime_ms = htonl(telemetry->uptime_ms),
+		.frames_captured = htonl(telemetry->frames_captured),
+		.frames_skipped = htonl(telemetry->frames_skipped),
+		.throttle_transitions = htonl(telemetry->throttle_transitions),
+		.consumer_lag = htons(telemetry->consumer_lag),
+		.throttle_state = telemetry->throttle_state,
+		.num_clients = telemetry->num_clients,
+		.wifi_reconnects = htonl(telemetry->wifi_reconnects),
+		.last_reconnect_ms = htonl(telemetry->last_reconnect_ms),
+		.rssi = telemetry->rssi,
+		.link_level = telemetry->link_level,
+		.camera_no_soi = htonl(telemetry->camera_no_soi),
+		.camera_no_eoi = htonl(telemetry->camera_no_eoi),
+		.camera_fb_overflows = htonl(telemetry->camera_fb_overflows),
+		.camera_queue_drops = htonl(telemetry->camera_queue_drops),
+	};
+
+	return send_client_message(&control_socket, MESSAGE_TELEMETRY, &message, sizeof(message));
+}
+
+bool server_send_latency(int client_index, const latency_histogram_t histograms[NUM_LATENCY_STAGES], SemaphoreHandle_t semaphore) {
+	control_socket_t control_socket;
+	if (!get_control_socket(client_index, semaphore, &control_socket)) {
+		return false;
+	}
+
+	latency_message_t message = {
+		.num_stages = NUM_LATENCY_STAGES,
+		.num_buckets = LATENCY_NUM_BUCKETS,
+		.bucket_base_shift = LATENCY_BUCKET_BASE_SHIFT,
+	};
+	for (int i = 0; i < NUM_LATENCY_STAGES; ++i) {
+		message.stages[i].max_us = htonl(histograms[i].max_us);
+		for (int j = 0; j < LATENCY_NUM_BUCKETS; ++j) {
+			message.stages[i].buckets[j] = htonl(histograms[i].buckets[j]);
+		}
+	}
+
+	return send_client_message(&control_socket, MESSAGE_LATENCY, &message, sizeof(message));
+}
+
+bool server_send_trace_chunk(int client_index, uint8_t core, bool is_last, const trace_event_t* events, size_t num_events,
+		SemaphoreHandle_t semaphore) {
+	control_socket_t control_socket;
+	if (num_events > TRACE_CHUNK_MAX_EVENTS || !get_control_socket(client_index, semaphore, &control_socket)) {
+		return false;
+	}
+
+	trace_message_t message = {
+		.core = core,
+		.is_last = is_last,
+		.num_events = htons(num_events),
+	};
+	for (size_t i = 0; i < num_events; ++i) {
+		message.events[i] = events[i];
+		message.events[i].timestamp_us = htonl(events[i].timestamp_us);
+		message.events[i].arg1 = htonl(events[i].arg1);
+	}
+
+	size_t message_length = offsetof(trace_message_t, events) + num_events * sizeof(trace_event_t);
+	return send_client_message(&control_socket, MESSAGE_TRACE, &message, message_length);
+}
+
+static void build_announce_message(announce_message_t* message, SemaphoreHandle_t semaphore) {
+	memset(message, 0, sizeof(announce_message_t));
+	message->header = htonl(MESSAGE_BROADCAST);
+	message->version = ANNOUNCE_VERSION;
+	message->control_port = htons(SERVER_PORT);
+	message->max_clients = connection_limit;
+	message->max_fps = CAMERA_TARGET_FRAMERATE;
+	strncpy(message->device_name, CONFIG_DEVICE_NAME, sizeof(message->device_name));
+
+	xSemaphoreTake(semaphore, portMAX_DELAY);
+	message->num_clients = num_active_connections;
+	message->num_streaming = __builtin_popcountll(video_interest_mask);
+	xSemaphoreGive(semaphore);
+
+	telemetry_t telemetry;
+	telemetry_snapshot(&telemetry);
+	message->throttle_state = telemetry.throttle_state;
+
+	camera_info_t camera_info;
+	if (camera_get_info(&camera_info) == ST_SUCCESS) {
+		message->max_framesize = camera_info.max_framesize;
+		message->max_width = htons(resolution[camera_info.max_framesize].width);
+		message->max_height = htons(resolution[camera_info.max_framesize].height);
+	}
+}
+
+void server_send_broadcast(SemaphoreHandle_t semaphore) {
 	struct sockaddr_in address = {0};
 	address.sin_family = AF_INET;
 	address.sin_addr.s_addr = htonl(INADDR_BROADCAST);
 	address.sin_port = htons(BROADCAST_PORT);
 
-	int message = htonl(MESSAGE_BROADCAST);
+	announce_message_t message;
+	build_announce_message(&message, semaphore);
 	sendto(broadcast_socket, &message, sizeof(message), 0, (struct sockaddr*)&address, sizeof(address));
 }
 
+int server_answer_discovery_probes(int timeout_ms, SemaphoreHandle_t semaphore) {
+	struct pollfd fd = { .fd = broadcast_socket, .events = POLLIN };
+	if (poll(&fd, 1, timeout_ms) <= 0) {
+		return 0;
+	}
+
+	int answered_probes = 0;
+	uint32_t probe;
+	struct sockaddr_in client_address;
+	socklen_t address_length = sizeof(client_address);
+	// Our own broadcasts loop back to this socket as well and are skipped by the header check
+	while (recvfrom(broadcast_socket, &probe, sizeof(probe), MSG_DONTWAIT, (struct sockaddr*)&client_address, &address_length) == sizeof(probe)) {
+		if (ntohl(probe) == MESSAGE_DISCOVERY_PROBE) {
+			announce_message_t message;
+			build_announce_message(&message, semaphore);
+			sendto(broadcast_socket, &message, sizeof(message), 0, (struct sockaddr*)&client_address, address_length);
+			answered_probes += 1;
+		}
+		address_length = sizeof(client_address);
+	}
+
+	return answered_probes;
+}
+
 static void get_rtp_header(rtp_header_t* header, uint16_t sequence_number, uint32_t timestamp, uint32_t payload_length) {
 	header->version_with_flags = ((uint8_t)2 << 6);
 	header->payload_type = RTP_JPEG_PAYLOAD;
@@ -297,7 +890,22 @@ static void get_rtp_header(rtp_header_t* header, uint16_t sequence_number, uint3
 }
 
 
-bool server_send_image_data(uint8_t* framebuffer, size_t buffer_length, uint16_t sequence_number, uint32_t timestamp) {
+// Written by the send task only
+static volatile uint32_t tx_attempts;
+static volatile uint32_t tx_failures;
+
+static void get_rtp_frame_metadata(rtp_frame_metadata_t* extension, const camera_fb_meta_t* meta) {
+	extension->profile = htons(RTP_FRAME_METADATA_PROFILE);
+	extension->length = htons((sizeof(rtp_frame_metadata_t) - 4) / 4);
+	extension->frame_sequence = htonl(meta->sequence);
+	extension->dropped_frames = htons(meta->dropped > UINT16_MAX ? UINT16_MAX : meta->dropped);
+	extension->agc_gain = htons(meta->agc_gain);
+	extension->aec_value = htonl(meta->aec_value);
+	extension->dma_us = htonl(meta->dma_us);
+}
+
+bool server_send_image_data(uint8_t* framebuffer, size_t buffer_length, const camera_fb_meta_t* meta,
+		uint16_t sequence_number, uint32_t timestamp, int64_t* first_packet_at) {
 	rtp_header_t rtp_header;
 	get_rtp_header(&rtp_header, sequence_number, timestamp, buffer_length);
 
@@ -310,23 +918,57 @@ bool server_send_image_data(uint8_t* framebuffer, size_t buffer_length, uint16_t
 	message.msg_iov = iovs;
 	message.msg_iovlen = 2;
 
-	for(size_t i = 0; i < MAX_CONNECTIONS; ++i) {
-		if (!connections[i].is_active || !(video_interest_mask & (1 << i))) {
+	// Only built when some client asked for it, the others keep getting the plain header
+	rtp_header_t extended_header;
+	rtp_frame_metadata_t metadata;
+	struct msghdr extended_message = {0};
+	struct iovec extended_iovs[3];
+	if (frame_metadata_mask & video_interest_mask) {
+		extended_header = rtp_header;
+		extended_header.version_with_flags |= RTP_EXTENSION_BIT;
+		get_rtp_frame_metadata(&metadata, meta);
+		extended_iovs[0].iov_base = &extended_header;
+		extended_iovs[0].iov_len = sizeof(extended_header);
+		extended_iovs[1].iov_base = &metadata;
+		extended_iovs[1].iov_len = sizeof(metadata);
+		extended_iovs[2] = iovs[1];
+		extended_message.msg_iov = extended_iovs;
+		extended_message.msg_iovlen = 3;
+	}
+
+	for (client_mask_t clients = video_interest_mask; clients;) {
+		int i = client_mask_pop(&clients);
+
+		// Half a capture interval of slack keeps capture jitter from dropping every other eligible frame
+		int64_t now = esp_timer_get_time();
+		if (connections[i].min_frame_interval_us &&
+				now - connections[i].last_frame_sent_at + 500000 / CAMERA_TARGET_FRAMERATE < connections[i].min_frame_interval_us) {
 			continue;
 		}
-		
-		struct sockaddr_in client_address = connections[i].rtp_address;
-		message.msg_name = &client_address;
-		message.msg_namelen = sizeof(client_address);
+		connections[i].last_frame_sent_at = now;
 
-		if (sendmsg(rtp_socket, &message, 0) < 0) {
-			ESP_LOGE("image_send", "Failed to send image data to client %s", inet_ntoa(client_address.sin_addr));
+		struct sockaddr_in client_address = connections[i].rtp_address;
+		struct msghdr* client_message = frame_metadata_mask & CLIENT_MASK(i) ? &extended_message : &message;
+		client_message->msg_name = &client_address;
+		client_message->msg_namelen = sizeof(client_address);
+
+		tx_attempts += 1;
+		if (sendmsg(rtp_socket, client_message, 0) < 0) {
+			tx_failures += 1;
+			TRACE_EVENT(TRACE_STAGE_SEND, TRACE_FRAME_SEND_FAILED, i, errno);
+		} else if (!*first_packet_at) {
+			*first_packet_at = esp_timer_get_time();
 		}
 	}
 
 	return true;
 }
 
+void server_get_tx_stats(uint32_t* attempts, uint32_t* failures) {
+	*attempts = tx_attempts;
+	*failures = tx_failures;
+}
+
 void server_disconnect_client(int client_index, SemaphoreHandle_t semaphore) {
 	xSemaphoreTake(semaphore, portMAX_DELAY);
 	server_disconnect_client_no_sync(client_index);
@@ -4,41 +4,76 @@
 #include <stdbool.h>
 
 #include "prelude.h"
+#include "app/latency.h"
+#include "app/telemetry.h"
+#include "app/trace.h"
+#include "client_mask.h"
+#include <esp_camera.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
 
-#define MAX_CONNECTIONS 10
+#define SERVER_PORT 3452
+#define BROADCAST_PORT 45122
+#define RTP_PORT 45120
+
+#define MAX_CONNECTIONS CONFIG_MAX_CONNECTIONS
+#define TRACE_CHUNK_MAX_EVENTS 64
+
+// Every control message is framed as [u32 type][u16 body length][body]
+#define MESSAGE_FRAME_HEADER_SIZE 6
+#define MAX_REQUEST_BODY_SIZE 64
+#define MAX_REQUESTS_PER_POLL 16
 
 typedef enum {
 	REQUEST_VIDEO_INTEREST = 0xAADCFBED,
+	REQUEST_TELEMETRY = 0xAADCFBEE,
+	REQUEST_LATENCY = 0xAADCFBEF,
+	REQUEST_TRACE_DUMP = 0xAADCFBF0,
+	REQUEST_TRACE_EXPORT = 0xAADCFBF1,
+	REQUEST_SENSOR_CONTROL = 0xAADCFBF2,
+	REQUEST_SENSOR_PROFILE = 0xAADCFBF3,
+	REQUEST_HEARTBEAT = 0xAADCFBF4,
+	REQUEST_CLIENT_PREFERENCES = 0xAADCFBF5,
 } request_type_t;
 
 typedef struct {
 	int client_index;
 	request_type_t request_type;
-	void* request_body;
+	uint8_t request_body[MAX_REQUEST_BODY_SIZE];
 	size_t request_body_length;
 } request_t;
 
 typedef struct client_connection client_connection_t;
 
 status_t server_start();
+status_t server_reopen_sockets(SemaphoreHandle_t semaphore);
 
 int server_accept_connections(SemaphoreHandle_t semaphore);
 void server_handle_requests(request_t* requests, size_t* num_requests, SemaphoreHandle_t semaphore);
 
+bool server_set_client_max_framerate(int client_index, uint8_t max_fps, SemaphoreHandle_t semaphore);
+bool server_set_client_frame_metadata(int client_index, bool enabled, SemaphoreHandle_t semaphore);
 char* server_get_client_address(int client_index, SemaphoreHandle_t semaphore);
 
 int server_get_clients_count();
 int server_get_clients_count_sync(SemaphoreHandle_t semaphore);
 
-uint16_t server_get_video_interest();
-uint16_t server_get_video_interest_sync(SemaphoreHandle_t semaphore);
-uint16_t server_update_client_video_interest(int client_index, bool is_interested);
+client_mask_t server_get_active_clients_sync(SemaphoreHandle_t semaphore);
+client_mask_t server_get_video_interest();
+client_mask_t server_get_video_interest_sync(SemaphoreHandle_t semaphore);
+client_mask_t server_update_client_video_interest(int client_index, bool is_interested);
 
 bool server_send_heartbeat(int client_index, SemaphoreHandle_t semaphore);
-void server_send_broadcast();
-bool server_send_image_data(uint8_t* framebuffer, size_t buffer_length, uint16_t sequence_number, uint32_t timestamp);
+bool server_send_telemetry(int client_index, const telemetry_t* telemetry, SemaphoreHandle_t semaphore);
+bool server_send_latency(int client_index, const latency_histogram_t histograms[NUM_LATENCY_STAGES], SemaphoreHandle_t semaphore);
+bool server_send_trace_chunk(int client_index, uint8_t core, bool is_last, const trace_event_t* events, size_t num_events,
+		SemaphoreHandle_t semaphore);
+void server_send_broadcast(SemaphoreHandle_t semaphore);
+int server_answer_discovery_probes(int timeout_ms, SemaphoreHandle_t semaphore);
+bool server_send_image_data(uint8_t* framebuffer, size_t buffer_length, const camera_fb_meta_t* meta,
+		uint16_t sequence_number, uint32_t timestamp, int64_t* first_packet_at);
+// Running totals of per-client frame sends, failures are mostly a full Wi-Fi TX queue
+void server_get_tx_stats(uint32_t* attempts, uint32_t* failures);
 
 void server_disconnect_client(int client_index, SemaphoreHandle_t semaphore);
 
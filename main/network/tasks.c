@@ -1,6 +1,15 @@
 #include "tasks.h"
 #include "prelude.h"
 #include "server.h"
+#include "espnow_transport.h"
+#include "mdns_service.h"
+#include "wifi.h"
+#include "app/latency.h"
+#include "app/link_policy.h"
+#include "app/telemetry.h"
+#include "app/trace.h"
+#include "camera/camera.h"
+#include "camera/history.h"
 
 #include <esp_camera.h>
 #include <esp_log.h>
@@ -11,14 +20,16 @@
 #include <freertos/task.h>
 
 #define BROADCAST_INTERVAL_MS 3000
+#define BROADCAST_MAX_INTERVAL_MS 48000
 
-#define TARGET_FRAMERATE 30
-#define CAPTURE_INTERVAL_MS 1000 / TARGET_FRAMERATE
+// Failures repeat every frame while they last, the log gets the first one and every hundredth after it
+#define FAILURE_LOG_INTERVAL 100
+#define CAPTURE_INTERVAL_MS 1000 / CAMERA_TARGET_FRAMERATE
 
 static void update_video_interest(int client_index, bool is_interested, task_sync_t* task_sync) {
 	xSemaphoreTake(task_sync->mutex, portMAX_DELAY);
-	uint16_t previous_interest = server_get_video_interest();
-	uint16_t new_interest = server_update_client_video_interest(client_index, is_interested);
+	client_mask_t previous_interest = server_get_video_interest();
+	client_mask_t new_interest = server_update_client_video_interest(client_index, is_interested);
 	xSemaphoreGive(task_sync->mutex);
 
 	if (!previous_interest && new_interest) {
@@ -30,6 +41,103 @@ static void update_video_interest(int client_index, bool is_interested, task_syn
 	ESP_LOGI("requests", "Received message video interest update from %d: %c", client_index, (uint8_t)is_interested);
 }
 
+static void send_telemetry(int client_index, task_sync_t* task_sync) {
+	telemetry_t telemetry;
+	telemetry_snapshot(&telemetry);
+	telemetry.num_clients = server_get_clients_count_sync(task_sync->mutex);
+
+	server_send_telemetry(client_index, &telemetry, task_sync->mutex);
+}
+
+static void send_latency(int client_index, task_sync_t* task_sync) {
+	latency_histogram_t histograms[NUM_LATENCY_STAGES];
+	latency_snapshot(histograms);
+
+	server_send_latency(client_index, histograms, task_sync->mutex);
+}
+
+// Body: a sequence of [u8 setting][i16 value] entries
+static void queue_sensor_controls(const request_t* request, size_t max_controls, task_sync_t* task_sync) {
+	const size_t entry_size = sizeof(uint8_t) + sizeof(int16_t);
+	size_t num_controls = request->request_body_length / entry_size;
+	if (num_controls == 0 || num_controls > max_controls || request->request_body_length % entry_size) {
+		ESP_LOGW("requests", "Malformed sensor control request from %d", request->client_index);
+		return;
+	}
+
+	sensor_control_batch_t batch = { .num_controls = num_controls };
+	for (size_t i = 0; i < num_controls; ++i) {
+		const uint8_t* entry = &request->request_body[i * entry_size];
+		batch.controls[i].setting = entry[0];
+		batch.controls[i].value = (int16_t)(entry[1] << 8 | entry[2]);
+
+		// A profile is applied all or nothing
+		if (camera_validate_sensor_control(&batch.controls[i]) != ST_SUCCESS) {
+			ESP_LOGW("requests", "Client %d sent invalid sensor setting %u = %d", request->client_index,
+					batch.controls[i].setting, batch.controls[i].value);
+			return;
+		}
+	}
+
+	if (xQueueSendToBack(task_sync->sensor_control_queue, &batch, 0) != pdTRUE) {
+		ESP_LOGW("requests", "Too many pending sensor controls, dropping the request from %d", request->client_index);
+	}
+}
+
+typedef enum {
+	PREFERENCE_MAX_FPS = 1,		// u8, 0 for no limit
+	PREFERENCE_FRAMESIZE = 2,	// u8 frame size from the hello profiles
+	PREFERENCE_FRAME_METADATA = 3,	// u8, 1 adds the frame metadata RTP header extension
+} client_preference_t;
+
+// Body: [u8 type][u8 length][value] entries; unknown ones are skipped so newer clients work with older firmware
+static void apply_client_preferences(const request_t* request, task_sync_t* task_sync) {
+	size_t offset = 0;
+	while (offset + 2 <= request->request_body_length) {
+		uint8_t type = request->request_body[offset];
+		uint8_t length = request->request_body[offset + 1];
+		const uint8_t* value = &request->request_body[offset + 2];
+		offset += 2 + length;
+		if (offset > request->request_body_length) {
+			ESP_LOGW("requests", "Truncated preferences from %d", request->client_index);
+			return;
+		}
+
+		if (type == PREFERENCE_MAX_FPS && length == 1) {
+			server_set_client_max_framerate(request->client_index, value[0], task_sync->mutex);
+		} else if (type == PREFERENCE_FRAME_METADATA && length == 1) {
+			server_set_client_frame_metadata(request->client_index, value[0], task_sync->mutex);
+		} else if (type == PREFERENCE_FRAMESIZE && length == 1) {
+			sensor_control_batch_t batch = {
+				.num_controls = 1,
+				.controls = { { SENSOR_FRAMESIZE, value[0] } },
+			};
+			if (camera_validate_sensor_control(&batch.controls[0]) != ST_SUCCESS ||
+					xQueueSendToBack(task_sync->sensor_control_queue, &batch, 0) != pdTRUE) {
+				ESP_LOGW("requests", "Can't apply frame size %u preferred by %d", value[0], request->client_index);
+			}
+		}
+	}
+}
+
+static void send_trace(int client_index, task_sync_t* task_sync) {
+	static trace_event_t events[TRACE_CHUNK_MAX_EVENTS];
+
+	for (int core = 0; core < portNUM_PROCESSORS; ++core) {
+		uint32_t head = trace_get_head(core);
+		uint32_t position = trace_get_tail(core);
+
+		// Each core is sent as at least one chunk, possibly empty, so the client sees every core
+		do {
+			size_t num_events = trace_read(core, &position, events, TRACE_CHUNK_MAX_EVENTS);
+			bool is_last = core == portNUM_PROCESSORS - 1 && position >= head;
+			if (!server_send_trace_chunk(client_index, core, is_last, events, num_events, task_sync->mutex)) {
+				return;
+			}
+		} while (position < head);
+	}
+}
+
 void task_accept_new_clients(void* params) {
     char* tag = "network_messages";
     ESP_LOGI(tag, "Starting handling network messages");
@@ -54,17 +162,43 @@ void task_handle_requests(void* params) {
 	task_sync_t* task_sync = (task_sync_t*) params;
 
 	size_t served_requests;
-	request_t requests_buffer[MAX_CONNECTIONS];
+	static request_t requests_buffer[MAX_REQUESTS_PER_POLL];
 	while(1) {
 		xEventGroupWaitBits(task_sync->event_group, CLIENTS_AVAILABLE_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
 
 		server_handle_requests(requests_buffer, &served_requests, task_sync->mutex);
 
 		for(int i = 0; i < served_requests; ++i) {
-			request_t request = requests_buffer[i];
-			switch(request.request_type) {
+			const request_t* request = &requests_buffer[i];
+			switch(request->request_type) {
 				case REQUEST_VIDEO_INTEREST:
-					update_video_interest(request.client_index, *(bool*)request.request_body, task_sync);
+					if (request->request_body_length >= 1) {
+						update_video_interest(request->client_index, request->request_body[0], task_sync);
+					}
+					break;
+				case REQUEST_TELEMETRY:
+					send_telemetry(request->client_index, task_sync);
+					break;
+				case REQUEST_LATENCY:
+					send_latency(request->client_index, task_sync);
+					break;
+				case REQUEST_TRACE_DUMP:
+					trace_dump();
+					break;
+				case REQUEST_TRACE_EXPORT:
+					send_trace(request->client_index, task_sync);
+					break;
+				case REQUEST_SENSOR_CONTROL:
+					queue_sensor_controls(request, 1, task_sync);
+					break;
+				case REQUEST_SENSOR_PROFILE:
+					queue_sensor_controls(request, MAX_SENSOR_CONTROLS_PER_BATCH, task_sync);
+					break;
+				case REQUEST_CLIENT_PREFERENCES:
+					apply_client_preferences(request, task_sync);
+					break;
+				case REQUEST_HEARTBEAT:
+					// Receiving anything already counts as a sign of life
 					break;
 			}
 		}
@@ -80,36 +214,167 @@ void task_handle_requests(void* params) {
 }
 
 void task_send_broadcasts(void* params) {
+	task_sync_t* task_sync = (task_sync_t*) params;
+
+	uint32_t interval_ms = BROADCAST_INTERVAL_MS;
+	int64_t next_broadcast_at = 0;
+	uint32_t ip_generation = wifi_get_ip_generation();
+	while(1) {
+		// Sockets follow the station address; announce the new one right away so clients find us again
+		if (ip_generation != wifi_get_ip_generation()) {
+			ip_generation = wifi_get_ip_generation();
+			server_reopen_sockets(task_sync->mutex);
+			next_broadcast_at = 0;
+		}
+
+		int64_t now = esp_timer_get_time();
+		int num_clients = server_get_clients_count_sync(task_sync->mutex);
+		bool has_clients = num_clients > 0;
+		mdns_service_update_load(num_clients, __builtin_popcountll(server_get_video_interest_sync(task_sync->mutex)));
+
+		// Without clients someone may be looking for us, so go back to the short interval right away
+		if (!has_clients && interval_ms > BROADCAST_INTERVAL_MS) {
+			interval_ms = BROADCAST_INTERVAL_MS;
+			if (next_broadcast_at > now + interval_ms * 1000LL) {
+				next_broadcast_at = now + interval_ms * 1000LL;
+			}
+		}
+
+		if (now >= next_broadcast_at) {
+			server_send_broadcast(task_sync->mutex);
+			// Connected clients already know us; new ones can still probe for an immediate answer
+			if (has_clients) {
+				interval_ms = interval_ms * 2 > BROADCAST_MAX_INTERVAL_MS ? BROADCAST_MAX_INTERVAL_MS : interval_ms * 2;
+			}
+			next_broadcast_at = now + interval_ms * 1000LL;
+		}
+
+		// Wake up at least every base interval to notice the last client leaving
+		int64_t wait_ms = (next_broadcast_at - now) / 1000;
+		server_answer_discovery_probes(wait_ms < BROADCAST_INTERVAL_MS ? wait_ms : BROADCAST_INTERVAL_MS, task_sync->mutex);
+	}
+}
+
+void task_send_heartbeats(void* params) {
+	task_sync_t* task_sync = (task_sync_t*) params;
+
+	while(1) {
+		xEventGroupWaitBits(task_sync->event_group, CLIENTS_AVAILABLE_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+
+		for (client_mask_t clients = server_get_active_clients_sync(task_sync->mutex); clients;) {
+			int i = client_mask_pop(&clients);
+			if (!server_send_heartbeat(i, task_sync->mutex)) {
+				// The request task clears the availability and interest bits on its next pass
+				ESP_LOGW("heartbeat", "Evicting unresponsive client %d", i);
+				server_disconnect_client(i, task_sync->mutex);
+			}
+		}
+
+		// Frames only flow while clients are connected, so the heartbeat cadence is a good time to look
+		camera_persist_fb_size();
+
+		vTaskDelay(pdMS_TO_TICKS(CONFIG_HEARTBEAT_INTERVAL_MS));
+	}
+}
+
+void task_monitor_link(void* params) {
+	// Link levels line up with the throttle steps: fair costs JPEG quality, poor costs frame rate
+	static const throttle_state_t link_throttle[NUM_LINK_LEVELS] = {
+		[LINK_GOOD] = THROTTLE_NONE,
+		[LINK_FAIR] = THROTTLE_QUALITY,
+		[LINK_POOR] = THROTTLE_FRAMERATE,
+	};
+
+	link_policy_t policy;
+	link_policy_init(&policy);
+
+	uint32_t last_attempts, last_failures;
+	server_get_tx_stats(&last_attempts, &last_failures);
 	while(1) {
-		server_send_broadcast();
-		vTaskDelay(pdMS_TO_TICKS(BROADCAST_INTERVAL_MS));
+		vTaskDelay(pdMS_TO_TICKS(CONFIG_LINK_SAMPLE_INTERVAL_MS));
+
+		uint32_t attempts, failures;
+		server_get_tx_stats(&attempts, &failures);
+		link_sample_t sample = {
+			.tx_attempts = attempts - last_attempts,
+			.tx_failures = failures - last_failures,
+		};
+		last_attempts = attempts;
+		last_failures = failures;
+
+		// While the station is away the reconnect manager is in charge, keep the last verdict
+		if (!wifi_get_rssi(&sample.rssi)) {
+			continue;
+		}
+
+		if (link_policy_update(&policy, &sample)) {
+			ESP_LOGI("link", "Link level %d at %d dBm, %u of %u sends failed", policy.level, sample.rssi,
+					sample.tx_failures, sample.tx_attempts);
+			camera_set_link_throttle(link_throttle[policy.level]);
+		}
+		telemetry_set_link(sample.rssi, policy.level);
 	}
 }
 
 void task_capture_camera_image(void* params) {
 	task_sync_t* task_sync = (task_sync_t*) params;
 
+	uint16_t consumer_lag = 0;
+	uint32_t capture_failures = 0;
 	while(1) {
+#if !CONFIG_ESPNOW_TRANSPORT
+		// The ESP-NOW peer can't ask for video, so with it configured every frame is captured
         xEventGroupWaitBits(task_sync->event_group, CLIENTS_AVAILABLE_BIT | CLIENTS_INTERESTED_IN_VIDEO_BIT,
                             pdFALSE, pdTRUE, portMAX_DELAY);
+#endif
 
 		uint64_t time_to_wait_ms = CAPTURE_INTERVAL_MS;
-		if (uxQueueMessagesWaiting(task_sync->image_produce_queue) == 0) {
+		bool consumers_lagging = uxQueueMessagesWaiting(task_sync->image_produce_queue) != 0;
+		consumer_lag = consumers_lagging ? consumer_lag + 1 : 0;
+		telemetry_set_consumer_lag(consumer_lag);
+		telemetry_set_throttle_state(camera_update_throttle(consumers_lagging));
+
+		// Controls are only drained here, between frames, so they never stall a capture in progress
+		sensor_control_batch_t batch;
+		while (xQueueReceive(task_sync->sensor_control_queue, &batch, 0) == pdTRUE) {
+			camera_apply_sensor_controls(&batch);
+		}
+
+		if (!consumers_lagging) {
 			uint64_t start = esp_timer_get_time();
+			TRACE_BEGIN(TRACE_STAGE_CAPTURE, TRACE_FRAME_CAPTURE);
 			camera_fb_t* fb = esp_camera_fb_get();
 			if (fb) {
-				xQueueSendToBack(task_sync->image_produce_queue, &fb, portMAX_DELAY);
+				captured_frame_t frame = {
+					.fb = fb,
+					.dequeued_at = esp_timer_get_time(),
+				};
+				TRACE_END(TRACE_STAGE_CAPTURE, TRACE_FRAME_CAPTURE, fb->len);
+
+				// cam_task is driver-owned, so its part is reconstructed from the frame's VSYNC timestamp
+				int64_t vsync_at = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+				latency_record(LATENCY_VSYNC_TO_DEQUEUE, frame.dequeued_at - vsync_at);
+				TRACE_COMPLETE(TRACE_STAGE_CAM_TASK, TRACE_CAM_FRAME, vsync_at, frame.dequeued_at);
+
+				TRACE_BEGIN(TRACE_STAGE_CAPTURE, TRACE_FRAME_ENQUEUE);
+				xQueueSendToBack(task_sync->image_produce_queue, &frame, portMAX_DELAY);
+				TRACE_END(TRACE_STAGE_CAPTURE, TRACE_FRAME_ENQUEUE, 0);
 				uint64_t end = esp_timer_get_time();
 
 				uint64_t elapsed_ms = (end - start) / 1000;
-				ESP_LOGI("image_capture", "Captured frame in %llu ms (%zu bytes)", elapsed_ms, fb->len);
+				telemetry_count_captured_frame();
 				time_to_wait_ms = elapsed_ms <= time_to_wait_ms ? time_to_wait_ms - elapsed_ms : 0;
 			} else {
-				ESP_LOGE("image_capture", "Failed to capture frame");
+				TRACE_END(TRACE_STAGE_CAPTURE, TRACE_FRAME_CAPTURE, 0);
+				TRACE_EVENT(TRACE_STAGE_CAPTURE, TRACE_FRAME_CAPTURE_FAILED, 0, 0);
+				if (++capture_failures % FAILURE_LOG_INTERVAL == 1) {
+					ESP_LOGE("image_capture", "Failed to capture frame (%u failures)", capture_failures);
+				}
 			}
 			
 		} else {
-			ESP_LOGI("image_capture", "Skipping a frame");
+			TRACE_EVENT(TRACE_STAGE_CAPTURE, TRACE_FRAME_SKIPPED, consumer_lag > UINT8_MAX ? UINT8_MAX : consumer_lag, 0);
+			telemetry_count_skipped_frame();
 		}
 
 		vTaskDelay(pdMS_TO_TICKS(time_to_wait_ms));
@@ -120,9 +385,17 @@ void task_recycle_camera_image(void* params) {
 	task_sync_t* task_sync = (task_sync_t*) params;
 
 	while(1) {
-		camera_fb_t* fb;
-		xQueueReceive(task_sync->image_recycle_queue, &fb, portMAX_DELAY);
+		captured_frame_t frame;
+		xQueueReceive(task_sync->image_recycle_queue, &frame, portMAX_DELAY);
+		TRACE_BEGIN(TRACE_STAGE_RECYCLE, TRACE_FRAME_RECYCLE);
+		// The clients already have the frame, so the copies do not delay sending. The driver only gets
+		// the buffer back after them though, and with two frame buffers a slow copy can hold up capture.
+		camera_fb_t* fb = frame.fb;
+		espnow_transport_queue_frame(fb->buf, fb->len);
+		history_append(fb->buf, fb->len, (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec);
 		esp_camera_fb_return(fb);
+		TRACE_END(TRACE_STAGE_RECYCLE, TRACE_FRAME_RECYCLE, 0);
+		latency_record(LATENCY_RECYCLE_DELAY, esp_timer_get_time() - frame.sent_at);
 	}
 
 }
@@ -132,22 +405,35 @@ void task_send_camera_image(void* params) {
 
 	uint16_t sequence_number = (uint16_t)(esp_random() % 100);
 	uint32_t timestamp = esp_random() % 1000;
+	uint32_t send_failures = 0;
     while (1) {
-		camera_fb_t* fb;
-		xQueueReceive(task_sync->image_produce_queue, &fb, portMAX_DELAY);
+		captured_frame_t frame;
+		xQueueReceive(task_sync->image_produce_queue, &frame, portMAX_DELAY);
+		camera_fb_t* fb = frame.fb;
 
 		uint64_t start = esp_timer_get_time();
+		int64_t first_packet_at = 0;
+		TRACE_BEGIN(TRACE_STAGE_SEND, TRACE_FRAME_SEND);
 		xSemaphoreTake(task_sync->mutex, portMAX_DELAY);
-		if (!server_send_image_data(fb->buf, fb->len, sequence_number++, timestamp)) {
-			ESP_LOGE("image_send", "Failed to send image to clients");
+		if (!server_send_image_data(fb->buf, fb->len, &fb->meta, sequence_number++, timestamp, &first_packet_at)) {
+			TRACE_EVENT(TRACE_STAGE_SEND, TRACE_FRAME_SEND_FAILED, 0, UINT32_MAX);
+			if (++send_failures % FAILURE_LOG_INTERVAL == 1) {
+				ESP_LOGE("image_send", "Failed to send image to clients (%u failures)", send_failures);
+			}
 		}
 		xSemaphoreGive(task_sync->mutex);
 		uint64_t end = esp_timer_get_time();
+		TRACE_END(TRACE_STAGE_SEND, TRACE_FRAME_SEND, fb->len);
+
+		if (first_packet_at) {
+			latency_record(LATENCY_DEQUEUE_TO_FIRST_PACKET, first_packet_at - frame.dequeued_at);
+		}
+		latency_record(LATENCY_SEND_DURATION, end - start);
 
 		uint32_t millisecods_elapsed = (end - start) / 1000;
-		ESP_LOGI("image_send", "Image sent in %zu ms", millisecods_elapsed);
 		timestamp += millisecods_elapsed;
 
-		xQueueSendToBack(task_sync->image_recycle_queue, &fb, portMAX_DELAY);
+		frame.sent_at = end;
+		xQueueSendToBack(task_sync->image_recycle_queue, &frame, portMAX_DELAY);
     }
 }
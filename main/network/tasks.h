@@ -6,22 +6,33 @@
 #include <freertos/semphr.h>
 #include <freertos/queue.h>
 
+#include <esp_camera.h>
+
 typedef enum {
 	CLIENTS_AVAILABLE_BIT = 1,
 	CLIENT_CONNECTED_BIT = 2,
 	CLIENTS_INTERESTED_IN_VIDEO_BIT = 4,
 } network_bits_t;
 
+typedef struct {
+	camera_fb_t* fb;
+	int64_t dequeued_at;
+	int64_t sent_at;
+} captured_frame_t;
+
 typedef struct {
 	SemaphoreHandle_t mutex;
 	EventGroupHandle_t event_group;
 	QueueHandle_t image_produce_queue;
 	QueueHandle_t image_recycle_queue;
+	QueueHandle_t sensor_control_queue;
 } task_sync_t;
 
 void task_accept_new_clients(void* params);
 void task_handle_requests(void* params);
 void task_send_broadcasts(void* params);
+void task_send_heartbeats(void* params);
+void task_monitor_link(void* params);
 void task_send_camera_image(void* params);
 
 void task_capture_camera_image(void* params);
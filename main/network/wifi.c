@@ -1,4 +1,5 @@
 #include "network/wifi.h"
+#include "app/telemetry.h"
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
@@ -9,34 +10,143 @@
 #include <esp_event.h>
 #include <esp_event_base.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <esp_wifi.h>
+#include <nvs.h>
+
+#include <string.h>
 
 #define WIFI_CONNECTED_BIT BIT0
-#define WIFI_FAIL_BIT BIT1
-#define MAX_RETRY_COUNT 5
+
+// Attempts that go straight to the cached AP before falling back to a full scan
+#define FAST_CONNECT_ATTEMPTS 2
+
+#define NVS_NAMESPACE "wifi"
+#define NVS_AP_KEY "ap"
 
 static char* TAG = "wifi-app";
 
-static int s_retry_num = 0;
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t channel;
+} cached_ap_t;
+
 static EventGroupHandle_t s_wifi_event_group;
+static esp_timer_handle_t s_reconnect_timer;
+static wifi_config_t s_wifi_config = {
+    .sta = {
+        .ssid = CONFIG_ESP_WIFI_SSID,
+        .password = CONFIG_ESP_WIFI_PASSWORD,
+        .threshold.authmode = WIFI_AUTH_WPA2_PSK,
+    }};
+
+static cached_ap_t s_cached_ap;
+static bool s_has_cached_ap;
+static int s_retry_num = 0;
+static int64_t s_link_lost_at;
+static uint32_t s_ip_address;
+static uint32_t s_ip_generation;
+
+static void load_cached_ap() {
+    nvs_handle_t handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+
+    size_t length = sizeof(s_cached_ap);
+    s_has_cached_ap = nvs_get_blob(handle, NVS_AP_KEY, &s_cached_ap, &length) == ESP_OK && length == sizeof(s_cached_ap);
+    nvs_close(handle);
+}
+
+static void store_cached_ap(const uint8_t bssid[6], uint8_t channel) {
+    if (s_has_cached_ap && s_cached_ap.channel == channel && !memcmp(s_cached_ap.bssid, bssid, 6)) {
+        return;
+    }
+
+    memcpy(s_cached_ap.bssid, bssid, 6);
+    s_cached_ap.channel = channel;
+    s_has_cached_ap = true;
+
+    // Flash is only written when the AP actually changes, so roaming between two APs costs little wear
+    nvs_handle_t handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK) {
+        nvs_set_blob(handle, NVS_AP_KEY, &s_cached_ap, sizeof(s_cached_ap));
+        nvs_commit(handle);
+        nvs_close(handle);
+    }
+}
+
+static void connect_to_ap() {
+    // Pinning BSSID and channel skips the all-channel scan, which is most of the association time
+    bool use_cache = s_has_cached_ap && s_retry_num < FAST_CONNECT_ATTEMPTS;
+    s_wifi_config.sta.bssid_set = use_cache;
+    s_wifi_config.sta.channel = use_cache ? s_cached_ap.channel : 0;
+    if (use_cache) {
+        memcpy(s_wifi_config.sta.bssid, s_cached_ap.bssid, sizeof(s_cached_ap.bssid));
+    }
+
+    esp_wifi_set_config(WIFI_IF_STA, &s_wifi_config);
+    esp_wifi_connect();
+}
+
+static void reconnect_timer_callback(void* arg) {
+    connect_to_ap();
+}
+
+static void schedule_reconnect() {
+    // The first retry is immediate, then the delay doubles up to the configured maximum
+    uint64_t delay_ms = 0;
+    if (s_retry_num > 0) {
+        int shift = s_retry_num - 1 < 16 ? s_retry_num - 1 : 16;
+        delay_ms = (uint64_t)CONFIG_WIFI_BACKOFF_BASE_MS << shift;
+        if (delay_ms > CONFIG_WIFI_BACKOFF_MAX_MS) {
+            delay_ms = CONFIG_WIFI_BACKOFF_MAX_MS;
+        }
+    }
+    s_retry_num += 1;
+
+    if (delay_ms == 0) {
+        connect_to_ap();
+    } else {
+        ESP_LOGI(TAG, "Reconnecting in %llu ms (attempt %d)", delay_ms, s_retry_num);
+        esp_timer_start_once(s_reconnect_timer, delay_ms * 1000);
+    }
+}
 
 static void wifi_event_handler(void* arg,
                                esp_event_base_t event_base,
                                int32_t event_id,
                                void* event_data) {
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
-        esp_wifi_connect();
+        connect_to_ap();
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+        wifi_event_sta_connected_t* event = (wifi_event_sta_connected_t*)event_data;
+        store_cached_ap(event->bssid, event->channel);
     } else if (event_base == WIFI_EVENT &&
                event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        if (s_retry_num < MAX_RETRY_COUNT) {
-            esp_wifi_connect();
-            s_retry_num += 1;
-        } else {
-            xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
+        if (xEventGroupGetBits(s_wifi_event_group) & WIFI_CONNECTED_BIT) {
+            wifi_event_sta_disconnected_t* event = (wifi_event_sta_disconnected_t*)event_data;
+            ESP_LOGW(TAG, "Lost connection to the AP, reason %d", event->reason);
+            s_link_lost_at = esp_timer_get_time();
+            xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
         }
+        schedule_reconnect();
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*)event_data;
         ESP_LOGI(TAG, "Got ip: %d.%d.%d.%d", IP2STR(&event->ip_info.ip));
+
+        if (s_link_lost_at) {
+            uint32_t reconnect_ms = (esp_timer_get_time() - s_link_lost_at) / 1000;
+            ESP_LOGI(TAG, "Reconnected in %u ms after %d attempts", reconnect_ms, s_retry_num);
+            telemetry_record_wifi_reconnect(reconnect_ms);
+            s_link_lost_at = 0;
+        }
+
+        if (s_ip_address && s_ip_address != event->ip_info.ip.addr) {
+            s_ip_generation += 1;
+        }
+        s_ip_address = event->ip_info.ip.addr;
+
         s_retry_num = 0;
         xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
     }
@@ -45,6 +155,7 @@ static void wifi_event_handler(void* arg,
 status_t wifi_init() {
     ESP_LOGI(TAG, "Initializing wifi module");
     s_wifi_event_group = xEventGroupCreate();
+    load_cached_ap();
 
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
@@ -54,46 +165,44 @@ status_t wifi_init() {
     wifi_init_config_t wifi_init_config = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&wifi_init_config));
 
-    esp_event_handler_instance_t wifi_evt_handler;
-    esp_event_handler_instance_t ip_evt_handler;
+    esp_timer_create_args_t timer_args = {
+        .callback = reconnect_timer_callback,
+        .name = "wifi_reconnect",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &s_reconnect_timer));
+
+    // The handlers stay registered for the lifetime of the app, so later AP drops are recovered from too
     ESP_ERROR_CHECK(esp_event_handler_instance_register(
-        WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, NULL,
-        &wifi_evt_handler));
+        WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, NULL, NULL));
     ESP_ERROR_CHECK(esp_event_handler_instance_register(
-        IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler, NULL,
-        &ip_evt_handler));
-    wifi_config_t wifi_config = {
-		.sta = {
-			.ssid = CONFIG_ESP_WIFI_SSID,
-			.password = CONFIG_ESP_WIFI_PASSWORD,
-			.threshold.authmode = WIFI_AUTH_WPA2_PSK,
-		}};
+        IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler, NULL, NULL));
 
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &s_wifi_config));
     ESP_ERROR_CHECK(esp_wifi_start());
 
-    EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group,
-                                           WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
-                                           pdFALSE, pdFALSE, portMAX_DELAY);
-
-    status_t status;
+    // Without an AP in range the app still starts; the reconnect backoff keeps trying in the background
+    EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group, WIFI_CONNECTED_BIT, pdFALSE, pdFALSE,
+                                           pdMS_TO_TICKS(CONFIG_WIFI_CONNECT_TIMEOUT_MS));
     if (bits & WIFI_CONNECTED_BIT) {
         ESP_LOGI(TAG, "Sucessfully connected to the WiFi");
-        status = ST_SUCCESS;
-    } else if (bits & WIFI_FAIL_BIT) {
-        ESP_LOGI(TAG, "Connection failed");
-        status = ST_WIFI_INITIALIZATION_FAILED;
     } else {
-        ESP_LOGI(TAG, "Unexpected event hapenned");
-        status = ST_WIFI_INITIALIZATION_FAILED;
+        ESP_LOGW(TAG, "Not connected after %d ms, starting offline", CONFIG_WIFI_CONNECT_TIMEOUT_MS);
     }
 
-    ESP_ERROR_CHECK(esp_event_handler_instance_unregister(
-        IP_EVENT, IP_EVENT_STA_GOT_IP, ip_evt_handler));
-    ESP_ERROR_CHECK(esp_event_handler_instance_unregister(
-        WIFI_EVENT, ESP_EVENT_ANY_ID, wifi_evt_handler));
-    vEventGroupDelete(s_wifi_event_group);
+    return ST_SUCCESS;
+}
+
+uint32_t wifi_get_ip_generation() {
+    return s_ip_generation;
+}
+
+bool wifi_get_rssi(int8_t* rssi) {
+    wifi_ap_record_t ap_info;
+    if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK) {
+        return false;
+    }
 
-    return status;
+    *rssi = ap_info.rssi;
+    return true;
 }
@@ -1,3 +1,12 @@
 #include "prelude.h"
 
+#include <stdbool.h>
+#include <stdint.h>
+
 status_t wifi_init();
+
+// Incremented whenever the station comes back with a different IP address
+uint32_t wifi_get_ip_generation();
+
+// Signal strength of the current AP, false while not associated
+bool wifi_get_rssi(int8_t* rssi);
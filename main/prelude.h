@@ -9,12 +9,17 @@ typedef int status_t;
 #define ST_WIFI_INITIALIZATION_FAILED 1
 #define ST_CAMERA_INITIALIZATION_FAILED 2
 #define ST_SERVER_INITIALIZATION_FAILED 3
+#define ST_PIPELINE_INVALID 4
+#define ST_SENSOR_CONTROL_INVALID 5
+#define ST_HISTORY_INITIALIZATION_FAILED 6
 
+// Must stay below configMAX_PRIORITIES (25) and below the camera driver's
+// cam_task, which runs at configMAX_PRIORITIES - 2
 typedef enum {
-	PRIORITY_LOW = 5,
-	PRIORITY_NORMAL = 50,
-	PRIORITY_HIGH = 250,
-	PRIORITY_URGENT = 1000,
+	PRIORITY_LOW = 2,
+	PRIORITY_NORMAL = 5,
+	PRIORITY_HIGH = 10,
+	PRIORITY_URGENT = 15,
 } priority_t;
 
 const char* get_error_name(esp_err_t errorCode);
@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+"""Simulate many streaming clients against one device to load test the client registry.
+
+Usage: client_sim.py <device address> [--clients 32] [--duration 30] [--silent 0]
+
+Every simulated client opens a control connection, reads the hello, declares video
+interest and answers heartbeats. --silent clients never answer, so the device should
+evict them after the configured number of missed heartbeats. All clients share this
+host's RTP port, so every frame arrives once per interested client.
+"""
+
+import argparse
+import selectors
+import socket
+import struct
+import time
+
+SERVER_PORT = 3452
+RTP_PORT = 45120
+
+MESSAGE_HELLO = 0xCABFEEFD
+MESSAGE_HEARTBEAT = 0xCABFEF01
+REQUEST_VIDEO_INTEREST = 0xAADCFBED
+REQUEST_HEARTBEAT = 0xAADCFBF4
+
+FRAME_HEADER = struct.Struct("!IH")
+
+
+class Client:
+    def __init__(self, index, address, silent):
+        self.index = index
+        self.silent = silent
+        self.buffer = b""
+        self.greeted = False
+        self.heartbeats = 0
+        self.sock = socket.create_connection((address, SERVER_PORT), timeout=5)
+        self.sock.setblocking(False)
+
+    def send(self, message_type, body=b""):
+        self.sock.sendall(FRAME_HEADER.pack(message_type, len(body)) + body)
+
+    def on_readable(self):
+        """Returns False once the device closed the connection."""
+        try:
+            data = self.sock.recv(4096)
+        except BlockingIOError:
+            return True
+        except ConnectionError:
+            return False
+        if not data:
+            return False
+
+        self.buffer += data
+        while len(self.buffer) >= FRAME_HEADER.size:
+            message_type, length = FRAME_HEADER.unpack_from(self.buffer)
+            if len(self.buffer) < FRAME_HEADER.size + length:
+                break
+            self.buffer = self.buffer[FRAME_HEADER.size + length:]
+            self.on_message(message_type)
+        return True
+
+    def on_message(self, message_type):
+        if message_type == MESSAGE_HELLO and not self.greeted:
+            self.greeted = True
+            self.send(REQUEST_VIDEO_INTEREST, b"\x01")
+        elif message_type == MESSAGE_HEARTBEAT:
+            self.heartbeats += 1
+            if not self.silent:
+                self.send(REQUEST_HEARTBEAT)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("address", help="device IP address")
+    parser.add_argument("--clients", type=int, default=32, help="number of clients to connect")
+    parser.add_argument("--duration", type=float, default=30, help="test length in seconds")
+    parser.add_argument("--silent", type=int, default=0, help="clients that never answer heartbeats")
+    args = parser.parse_args()
+
+    selector = selectors.DefaultSelector()
+
+    rtp = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    rtp.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    rtp.bind(("", RTP_PORT))
+    rtp.setblocking(False)
+    selector.register(rtp, selectors.EVENT_READ, None)
+
+    clients = []
+    for index in range(args.clients):
+        try:
+            client = Client(index, args.address, index < args.silent)
+        except OSError as error:
+            print("client {} failed to connect: {}".format(index, error))
+            continue
+        clients.append(client)
+        selector.register(client.sock, selectors.EVENT_READ, client)
+
+    connected = len(clients)
+    closed = []
+    packets = 0
+    frame_bytes = 0
+    start = time.monotonic()
+    next_report = start + 1
+
+    while time.monotonic() - start < args.duration:
+        for key, _ in selector.select(timeout=0.1):
+            if key.data is None:
+                try:
+                    while True:
+                        packet = rtp.recv(65536)
+                        packets += 1
+                        frame_bytes += len(packet)
+                except BlockingIOError:
+                    pass
+            elif not key.data.on_readable():
+                selector.unregister(key.fileobj)
+                key.fileobj.close()
+                closed.append(key.data)
+
+        now = time.monotonic()
+        if now >= next_report:
+            print("{:5.1f}s: {} connected, {} closed by the device, {} RTP packets ({:.1f} KiB)".format(
+                now - start, connected - len(closed), len(closed), packets, frame_bytes / 1024))
+            next_report += 1
+
+    silent_evicted = sum(1 for client in closed if client.silent)
+    responsive_evicted = sum(1 for client in closed if not client.silent)
+    print("Connected {} of {} clients".format(connected, args.clients))
+    print("Evicted {} of {} silent clients, dropped {} responsive clients".format(
+        silent_evicted, min(args.silent, connected), responsive_evicted))
+    print("Received {} RTP packets, {:.1f} per second".format(packets, packets / args.duration))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,75 @@
+// Replays a recorded link trace through the firmware's link policy.
+//
+// Build: cc -std=c99 -Wall -Imain/app -o link_policy_sim tools/link_policy_sim.c main/app/link_policy.c
+// Usage: link_policy_sim <trace.csv>
+//
+// Each trace line is "time_ms,rssi,tx_attempts,tx_failures[,expected_level]", one line per link
+// sample; lines starting with '#' are comments. When the expected level is given, the policy has
+// to be at that level after the sample, otherwise the run fails.
+
+#include "link_policy.h"
+
+#include <stdio.h>
+
+static const char* level_names[NUM_LINK_LEVELS] = { "good", "fair", "poor" };
+
+int main(int argc, char** argv) {
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <trace.csv>\n", argv[0]);
+		return 2;
+	}
+
+	FILE* trace = fopen(argv[1], "r");
+	if (!trace) {
+		perror(argv[1]);
+		return 2;
+	}
+
+	link_policy_t policy;
+	link_policy_init(&policy);
+
+	char line[128];
+	int line_number = 0;
+	int num_samples = 0;
+	int num_transitions = 0;
+	int num_mismatches = 0;
+	while (fgets(line, sizeof(line), trace)) {
+		line_number += 1;
+		if (line[0] == '#' || line[0] == '\n') {
+			continue;
+		}
+
+		unsigned time_ms, attempts, failures;
+		int rssi, expected;
+		int num_fields = sscanf(line, "%u,%d,%u,%u,%d", &time_ms, &rssi, &attempts, &failures, &expected);
+		if (num_fields < 4) {
+			fprintf(stderr, "%s:%d: malformed sample\n", argv[1], line_number);
+			fclose(trace);
+			return 2;
+		}
+
+		link_sample_t sample = {
+			.rssi = (int8_t)rssi,
+			.tx_attempts = attempts,
+			.tx_failures = failures,
+		};
+		num_samples += 1;
+
+		if (link_policy_update(&policy, &sample)) {
+			num_transitions += 1;
+			printf("%8u ms  %4d dBm  %3u/%-3u failed  -> %s\n", time_ms, rssi, failures, attempts,
+					level_names[policy.level]);
+		}
+
+		if (num_fields == 5 && (int)policy.level != expected) {
+			fprintf(stderr, "%s:%d: expected %s, policy is %s\n", argv[1], line_number,
+					expected >= 0 && expected < NUM_LINK_LEVELS ? level_names[expected] : "?",
+					level_names[policy.level]);
+			num_mismatches += 1;
+		}
+	}
+	fclose(trace);
+
+	printf("%d samples, %d transitions, %d mismatches\n", num_samples, num_transitions, num_mismatches);
+	return num_mismatches ? 1 : 0;
+}
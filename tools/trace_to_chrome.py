@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+"""Fetch the hot path trace from a device and convert it to Chrome trace_event JSON.
+
+Usage: trace_to_chrome.py <device address> [-o trace.json]
+
+Open the result in chrome://tracing or https://ui.perfetto.dev. The firmware has to be
+built with CONFIG_HOT_PATH_TRACE enabled, otherwise the trace is empty.
+"""
+
+import argparse
+import json
+import socket
+import struct
+
+SERVER_PORT = 3452
+
+MESSAGE_HELLO = 0xCABFEEFD
+MESSAGE_TRACE = 0xCABFEF00
+REQUEST_TRACE_EXPORT = 0xAADCFBF1
+
+HELLO_SIZE = 32
+EVENT_FORMAT = "!IBBBBI"
+EVENT_SIZE = struct.calcsize(EVENT_FORMAT)
+
+# Must match trace_stage_t, trace_event_id_t and trace_phase_t in main/app/trace.h
+STAGES = ["cam_task", "capture", "send", "recycle", "requests"]
+EVENTS = [
+    "cam frame",
+    "frame capture",
+    "frame enqueue",
+    "frame send",
+    "frame recycle",
+    "frame skipped",
+    "capture failed",
+    "send failed",
+    "request received",
+]
+PHASES = ["i", "B", "E", "X"]
+
+
+def recv_exact(sock, length):
+    data = b""
+    while len(data) < length:
+        chunk = sock.recv(length - len(data))
+        if not chunk:
+            raise ConnectionError("device closed the connection")
+        data += chunk
+    return data
+
+
+def recv_message(sock):
+    """Control messages are framed as [u32 type][u16 body length][body]."""
+    message_type, length = struct.unpack("!IH", recv_exact(sock, 6))
+    return message_type, recv_exact(sock, length)
+
+
+def fetch_events(address):
+    with socket.create_connection((address, SERVER_PORT), timeout=5) as sock:
+        message_type, body = recv_message(sock)
+        if message_type != MESSAGE_HELLO:
+            raise RuntimeError("unexpected greeting")
+        name = body[:HELLO_SIZE].split(b"\0", 1)[0].decode()
+
+        sock.sendall(struct.pack("!IH", REQUEST_TRACE_EXPORT, 0))
+
+        events = []
+        is_last = False
+        while not is_last:
+            message_type, body = recv_message(sock)
+            if message_type != MESSAGE_TRACE:
+                continue
+            core, is_last, num_events = struct.unpack_from("!BBH", body)
+            for offset in range(4, 4 + num_events * EVENT_SIZE, EVENT_SIZE):
+                events.append((core,) + struct.unpack_from(EVENT_FORMAT, body, offset))
+
+        return name, events
+
+
+def unwrap_timestamps(events):
+    """Timestamps are the low 32 bits of esp_timer, which wrap every ~71 minutes.
+
+    Events arrive in ring order per core, so a large step backwards means a wrap.
+    """
+    result = []
+    previous = {}
+    epochs = {}
+    for event in events:
+        core, timestamp = event[0], event[1]
+        if core in previous and previous[core] - timestamp > 1 << 31:
+            epochs[core] = epochs.get(core, 0) + (1 << 32)
+        previous[core] = timestamp
+        result.append((core, timestamp + epochs.get(core, 0)) + event[2:])
+    return result
+
+
+def name_of(table, index):
+    return table[index] if index < len(table) else "unknown {}".format(index)
+
+
+def to_chrome(name, events):
+    trace = [{"name": "process_name", "ph": "M", "pid": 0, "args": {"name": name}}]
+    for stage, stage_name in enumerate(STAGES):
+        trace.append({"name": "thread_name", "ph": "M", "pid": 0, "tid": stage, "args": {"name": stage_name}})
+
+    for core, timestamp, event, phase, stage, arg0, arg1 in unwrap_timestamps(events):
+        entry = {
+            "name": name_of(EVENTS, event),
+            "ph": name_of(PHASES, phase),
+            "ts": timestamp,
+            "pid": 0,
+            "tid": stage,
+            "args": {"core": core, "arg0": arg0, "arg1": arg1},
+        }
+        if entry["ph"] == "X":
+            entry["dur"] = arg1
+        elif entry["ph"] == "i":
+            entry["s"] = "t"
+        trace.append(entry)
+
+    return {"traceEvents": trace, "displayTimeUnit": "ms"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("address", help="device IP address")
+    parser.add_argument("-o", "--output", default="trace.json", help="output file")
+    args = parser.parse_args()
+
+    name, events = fetch_events(args.address)
+    with open(args.output, "w") as output:
+        json.dump(to_chrome(name, events), output)
+    print("Wrote {} events from {} to {}".format(len(events), name, args.output))
+
+
+if __name__ == "__main__":
+    main()